@@ -6,10 +6,14 @@
 */
 
 #include "backend/blowfish.h"
+#include "backend/cbc.h"
 
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QObject>
+#include <QSysInfo>
 #include <QTest>
+#include <QtEndian>
 
 #include <stdint.h>
 
@@ -18,6 +22,13 @@ class TestBlowfish : public QObject
     Q_OBJECT
 private Q_SLOTS:
     void testBlowfishCipher();
+    void testBlowfishBlocks();
+    void testBlowfishLegacyWordOrder();
+    void testBlowfishThroughput_data();
+    void testBlowfishThroughput();
+    void testBlowfishHasKey();
+    void testBlowfishKeySchedule_data();
+    void testBlowfishKeySchedule();
 };
 
 // Source for test vectors: https://www.schneier.com/code/vectors.txt
@@ -82,6 +93,160 @@ void TestBlowfish::testBlowfishCipher()
     }
 }
 
+// Buffers going through the interleaved kernel give the same result as
+// their blocks one by one, whatever the number of leftover blocks.
+void TestBlowfish::testBlowfishBlocks()
+{
+    QByteArray key = readBinaryData(keys[4]);
+    BlowFish bf;
+    bf.setKey(key.data(), 8 * key.count());
+    QVERIFY(bf.readyToGo());
+
+    for (int blocks = 1; blocks <= 19; ++blocks) {
+        QByteArray cleartext;
+        for (int i = 0; i < blocks; ++i) {
+            cleartext += readBinaryData(cleartexts[i % ARRAY_SIZE(cleartexts)]);
+        }
+
+        QByteArray expected = cleartext;
+        for (int i = 0; i < blocks; ++i) {
+            QCOMPARE(bf.encrypt(expected.data() + 8 * i, 8), 8);
+        }
+
+        QByteArray temp = cleartext;
+        QCOMPARE(bf.encrypt(temp.data(), temp.count()), temp.count());
+        QCOMPARE(temp, expected);
+        QCOMPARE(bf.decrypt(temp.data(), temp.count()), temp.count());
+        QCOMPARE(temp, cleartext);
+    }
+}
+
+// Written by the code before the interleaved kernel, on a big endian host,
+// with keys[4].
+static const char legacyCleartext[] = "Written by kwalletd on a big endian host, before the word order could be chosen.";
+static const char legacyCiphertext[] =
+    "0B65639C87E791C993B05970D6FF35ACDD837E333D5B22C9E7491582D10B95A11953C0D1"
+    "F3661795BB2858BFD34F7CF06F6DB8BA79BD443001084D1A2039CAEFCEF74E8B625026049F"
+    "7F21057705F564";
+
+// Swaps the bytes of each word, turning the blocks of a big endian host into
+// those of a little endian one and back.
+static void swapWords(QByteArray &data)
+{
+    for (int i = 0; i + 4 <= data.size(); i += 4) {
+        qToBigEndian<quint32>(qFromLittleEndian<quint32>(data.constData() + i), data.data() + i);
+    }
+}
+
+// Wallet files written on big endian hosts have little endian words, and
+// are still read there.
+void TestBlowfish::testBlowfishLegacyWordOrder()
+{
+    const QByteArray cleartext(legacyCleartext);
+    const QByteArray ciphertext = readBinaryData(legacyCiphertext);
+    QCOMPARE(ciphertext.size(), cleartext.size());
+
+    QByteArray key = readBinaryData(keys[4]);
+    BlowFish bf;
+    bf.setKey(key.data(), 8 * key.count());
+    QVERIFY(bf.readyToGo());
+
+    // on a little endian host, decrypt the words such a file would have
+    const bool swap = QSysInfo::ByteOrder == QSysInfo::LittleEndian;
+    QByteArray temp = ciphertext;
+    if (swap) {
+        swapWords(temp);
+    }
+    QCOMPARE(bf.decrypt(temp.data(), temp.count()), temp.count());
+    if (swap) {
+        swapWords(temp);
+    }
+    QCOMPARE(temp, cleartext);
+}
+
+void TestBlowfish::testBlowfishThroughput_data()
+{
+    QTest::addColumn<bool>("decrypt");
+    QTest::addColumn<int>("size");
+
+    QTest::newRow("encrypt 8 bytes") << false << 8;
+    QTest::newRow("encrypt 64 KiB") << false << 64 * 1024;
+    QTest::newRow("decrypt 8 bytes") << true << 8;
+    QTest::newRow("decrypt 64 KiB") << true << 64 * 1024;
+}
+
+void TestBlowfish::testBlowfishThroughput()
+{
+    QFETCH(bool, decrypt);
+    QFETCH(int, size);
+
+    QByteArray key = readBinaryData(keys[4]);
+    BlowFish bf;
+    bf.setKey(key.data(), 8 * key.count());
+    QByteArray data(size, 'x');
+
+    // a fixed amount of data, whatever the size of the buffers
+    const int rounds = 16 * 1024 * 1024 / size;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < rounds; ++i) {
+        if (decrypt) {
+            bf.decrypt(data.data(), size);
+        } else {
+            bf.encrypt(data.data(), size);
+        }
+    }
+    qInfo("%s: %lld MiB/s", QTest::currentDataTag(), 16 * 1000 / qMax<qint64>(timer.elapsed(), 1));
+}
+
+void TestBlowfish::testBlowfishHasKey()
+{
+    QByteArray key = readBinaryData(keys[4]);
+    QByteArray other = readBinaryData(keys[7]);
+    BlowFish bf;
+    QVERIFY(!bf.hasKey(key.data(), 8 * key.count()));
+
+    bf.setKey(key.data(), 8 * key.count());
+    QVERIFY(bf.hasKey(key.data(), 8 * key.count()));
+    QVERIFY(!bf.hasKey(key.data(), 8 * (key.count() - 1)));
+    QVERIFY(!bf.hasKey(other.data(), 8 * other.count()));
+
+    QVERIFY(!bf.setKey(key.data(), 0));
+    QVERIFY(bf.hasKey(key.data(), 8 * key.count()));
+}
+
+void TestBlowfish::testBlowfishKeySchedule_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("schedule expanded for each record") << false;
+    QTest::newRow("schedule cached") << true;
+}
+
+// Encrypts records of the size of a journal entry one after the other, the
+// way a wallet is synced after each change.
+void TestBlowfish::testBlowfishKeySchedule()
+{
+    QFETCH(bool, cached);
+
+    QByteArray key(56, 'k');
+    BlowFish bf;
+    bf.setKey(key.data(), 8 * key.count());
+    QByteArray data(512, 'x');
+
+    const int rounds = 2000;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < rounds; ++i) {
+        if (!cached) {
+            QVERIFY(bf.setKey(key.data(), 8 * key.count()));
+        }
+        CipherBlockChain cbc(&bf);
+        QVERIFY(cbc.encrypt(data.data(), data.size()) >= 0);
+    }
+    qInfo("%s: %lld records/s", QTest::currentDataTag(), rounds * qint64(1000) / qMax<qint64>(timer.elapsed(), 1));
+}
+
 QTEST_APPLESS_MAIN(TestBlowfish)
 
 #include "blowfishtest.moc"
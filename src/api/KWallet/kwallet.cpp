@@ -14,7 +14,9 @@
 
 #include <QApplication>
 #include <QDBusConnection>
+#include <QDBusPendingCallWatcher>
 #include <QRegularExpression>
+#include <QSet>
 
 #include <KConfigGroup>
 #include <KSharedConfig>
@@ -25,6 +27,8 @@
 #endif
 
 #include "kwallet_interface.h"
+#include "kwalletcache_p.h"
+#include "kwalletfd_p.h"
 
 #if HAVE_KSECRETSSERVICE
 typedef QMap<QString, KSecretsService::StringStringMap> StringToStringStringMapMap;
@@ -44,6 +48,12 @@ public:
     KWalletDLauncher &operator=(const KWalletDLauncher &) = delete;
     org::kde::KWallet &getInterface();
 
+    // Whether the asynchronous calls can pass values in file descriptors.
+    // They can't find out by trying, as a call made again would overtake
+    // the calls made since. So the first time, kwalletd is asked in the
+    // background and values go in the message until it answered.
+    bool canUseFdsAsync();
+
     // this static variable is used below to switch between old KWallet
     // infrastructure and the new one which is built on top of the new
     // KSecretsService infrastructure. It's value can be changed via the
@@ -52,6 +62,14 @@ public:
     org::kde::KWallet *m_wallet_deamon;
     KConfigGroup m_cgroup;
     bool m_walletEnabled;
+    // whether values can be passed in file descriptors, which kwalletd
+    // from before readEntryFd and writeEntryFd can't
+    bool m_useFds;
+    // whether kwalletd answered one of those calls already
+    bool m_fdsChecked;
+    bool m_checkingFds;
+    // whether kwalletd has readEntryTyped
+    bool m_useReadEntryTyped;
 };
 
 Q_GLOBAL_STATIC(KWalletDLauncher, walletLauncher)
@@ -61,6 +79,17 @@ static QString appid()
     return qApp->applicationName();
 }
 
+// The folder of each entry, for the calls on many entries.
+static QStringList sameFolder(const QString &folder, int count)
+{
+    QStringList folders;
+    folders.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        folders.append(folder);
+    }
+    return folders;
+}
+
 static void registerTypes()
 {
     static bool registered = false;
@@ -135,6 +164,63 @@ public:
 
     void walletServiceUnregistered();
 
+    // Writes a large value through a memfd. Returns false if it has to go
+    // in the message instead.
+    bool writeEntryFd(const QString &key, const QByteArray &value, Wallet::EntryType entryType, int &rc);
+
+    // Reads whether the entry exists, its type and value in one call, and
+    // keeps them in the read cache. Returns false if it has to be done with
+    // the older calls instead.
+    bool readEntryTyped(const QString &key, bool &exists, Wallet::EntryType &entryType, QByteArray &value, int &rc);
+
+    // Keeps a value read from @p folder in the read cache. Empty values
+    // aren't kept, kwalletd returns those for missing entries too.
+    void cacheValue(const QString &folder, const QString &key, Wallet::EntryType entryType, const QByteArray &value)
+    {
+        if (!value.isEmpty()) {
+            cache.insert(folder, key, entryType, &value);
+        }
+    }
+
+    // Calls @p done with the reply to @p call once it arrives, unless the
+    // Wallet is deleted first.
+    template<typename T, typename F>
+    void whenReplied(const QDBusPendingReply<T> &call, F done)
+    {
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, q);
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [watcher, done]() {
+            watcher->deleteLater();
+            done(QDBusPendingReply<T>(*watcher));
+        });
+    }
+
+    // Calls @p done from the event loop, for answers known without asking
+    // kwalletd.
+    template<typename F>
+    void later(F done)
+    {
+        QMetaObject::invokeMethod(q, done, Qt::QueuedConnection);
+    }
+
+    // Returns the result of a write, or 0 at once if replies aren't waited
+    // for, see Wallet::setWriteBehind().
+    int write(const QDBusPendingReply<int> &call);
+    // Waits until no more than @p keep writes are in flight, keeping the
+    // first error.
+    void waitForWrites(int keep);
+    // Waits for all the writes in flight, before the wallet is closed, and
+    // logs the error flush() didn't collect, as it can't be any more.
+    void finishWrites();
+
+    // The asynchronous calls for kwalletd, which pass values in a memfd once
+    // it is known to have the calls for that, see canUseFdsAsync().
+    void readEntryAsync(const QString &folder, const QString &key, const std::function<void(int, const QByteArray &)> &callback);
+    void writeEntryAsync(const QString &folder,
+                         const QString &key,
+                         const QByteArray &value,
+                         Wallet::EntryType entryType,
+                         const std::function<void(int)> &callback);
+
 #if HAVE_KSECRETSSERVICE
     template<typename T>
     int writeEntry(const QString &key, const T &value, Wallet::EntryType entryType)
@@ -237,6 +323,23 @@ public:
     QString folder;
     int handle;
     int transactionId;
+    WalletCache cache;
+
+    // The folders of the wallet as last seen, so hasFolder() and
+    // setFolder() don't ask kwalletd. Dropped on folderListUpdated.
+    QSet<QString> folders;
+    bool foldersKnown = false;
+
+    // The writes sent without waiting for their replies, oldest first.
+    QList<QDBusPendingReply<int>> pendingWrites;
+    int writeWindow = 0;
+    int writeError = 0;
+
+    void forgetFolders()
+    {
+        folders.clear();
+        foldersKnown = false;
+    }
 };
 
 #if HAVE_KSECRETSSERVICE
@@ -297,6 +400,7 @@ Wallet::~Wallet()
 #endif
         if (d->handle != -1) {
             if (!walletLauncher.isDestroyed()) {
+                d->finishWrites();
                 walletLauncher()->getInterface().close(d->handle, false, appid());
             } else {
                 qCDebug(KWALLET_API_LOG) << "Problem with static destruction sequence."
@@ -660,10 +764,13 @@ int Wallet::lockWallet()
             return -1;
         }
 
+        d->finishWrites();
         QDBusReply<int> r = walletLauncher()->getInterface().close(d->handle, true, appid());
         d->handle = -1;
         d->folder.clear();
         d->name.clear();
+        d->cache.clear();
+        d->forgetFolders();
         if (r.isValid()) {
             return r;
         } else {
@@ -729,9 +836,12 @@ void Wallet::slotWalletClosed(int handle)
     } else {
 #endif
         if (d->handle == handle) {
+            d->finishWrites();
             d->handle = -1;
             d->folder.clear();
             d->name.clear();
+            d->cache.clear();
+            d->forgetFolders();
             Q_EMIT walletClosed();
         }
 #if HAVE_KSECRETSSERVICE
@@ -778,7 +888,10 @@ QStringList Wallet::folderList()
             qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
             return QStringList();
         } else {
-            return r;
+            const QStringList list = r.value();
+            d->folders = QSet<QString>(list.begin(), list.end());
+            d->foldersKnown = true;
+            return list;
         }
 #if HAVE_KSECRETSSERVICE
     }
@@ -840,11 +953,25 @@ bool Wallet::hasFolder(const QString &f)
             return false;
         }
 
+        if (!d->foldersKnown) {
+            folderList();
+            if (d->foldersKnown) {
+                return d->folders.contains(f);
+            }
+        }
+        if (d->folders.contains(f)) {
+            return true;
+        }
+
+        // it may have been created since, by another application
         QDBusReply<bool> r = walletLauncher()->getInterface().hasFolder(d->handle, f, appid());
         if (!r.isValid()) {
             qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
             return false;
         } else {
+            if (r.value() && d->foldersKnown) {
+                d->folders.insert(f);
+            }
             return r;
         }
 #if HAVE_KSECRETSSERVICE
@@ -873,6 +1000,9 @@ bool Wallet::createFolder(const QString &f)
                 qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
                 return false;
             } else {
+                if (r.value() && d->foldersKnown) {
+                    d->folders.insert(f);
+                }
                 return r;
             }
         }
@@ -899,13 +1029,7 @@ bool Wallet::setFolder(const QString &f)
             return rc;
         }
 
-        // Don't do this - the folder could have disappeared?
-#if 0
-        if (f == d->folder) {
-            return true;
-        }
-#endif
-
+        // no round trip unless the folder isn't known
         if (hasFolder(f)) {
             d->folder = f;
             rc = true;
@@ -950,6 +1074,8 @@ bool Wallet::removeFolder(const QString &f)
         }
 
         QDBusReply<bool> r = walletLauncher()->getInterface().removeFolder(d->handle, f, appid());
+        d->cache.removeFolder(f);
+        d->folders.remove(f);
         if (d->folder == f) {
             setFolder(QString());
         }
@@ -1041,9 +1167,36 @@ int Wallet::readEntry(const QString &key, QByteArray &value)
             return rc;
         }
 
+        if (d->cache.value(d->folder, key, Unknown, value)) {
+            return 0;
+        }
+
+        if (walletLauncher()->m_useFds) {
+            QDBusReply<QDBusVariant> r = walletLauncher()->getInterface().readEntryFd(d->handle, d->folder, key, appid());
+            if (r.isValid()) {
+                walletLauncher()->m_fdsChecked = true;
+                // large values come in a memfd
+                const QVariant v = r.value().variant();
+                if (v.userType() == qMetaTypeId<QDBusUnixFileDescriptor>()) {
+                    if (!valueFromFd(v.value<QDBusUnixFileDescriptor>(), value)) {
+                        return rc;
+                    }
+                } else {
+                    value = v.toByteArray();
+                }
+                d->cacheValue(d->folder, key, Unknown, value);
+                return 0;
+            }
+            if (r.error().type() != QDBusError::UnknownMethod) {
+                return rc;
+            }
+            walletLauncher()->m_useFds = false;
+        }
+
         QDBusReply<QByteArray> r = walletLauncher()->getInterface().readEntry(d->handle, d->folder, key, appid());
         if (r.isValid()) {
             value = r;
+            d->cacheValue(d->folder, key, Unknown, value);
             rc = 0;
         }
 #if HAVE_KSECRETSSERVICE
@@ -1173,6 +1326,8 @@ int Wallet::renameEntry(const QString &oldName, const QString &newName)
             return rc;
         }
 
+        d->cache.remove(d->folder, oldName);
+        d->cache.remove(d->folder, newName);
         QT_WARNING_PUSH
         QT_WARNING_DISABLE_CLANG("-Wdeprecated-declarations")
         QT_WARNING_DISABLE_GCC("-Wdeprecated-declarations")
@@ -1208,10 +1363,31 @@ int Wallet::readMap(const QString &key, QMap<QString, QString> &value)
             return rc;
         }
 
+        QByteArray v;
+        if (d->cache.value(d->folder, key, Map, v)) {
+            QDataStream ds(&v, QIODevice::ReadOnly);
+            ds >> value;
+            v.fill(0);
+            return 0;
+        }
+
+        // with the cache, the type and value are worth having for later
+        bool exists = false;
+        EntryType entryType = Unknown;
+        if (d->cache.isEnabled() && d->readEntryTyped(key, exists, entryType, v, rc)) {
+            if (rc == 0 && entryType == Map && !v.isEmpty()) {
+                QDataStream ds(&v, QIODevice::ReadOnly);
+                ds >> value;
+            }
+            v.fill(0);
+            return rc;
+        }
+
         QDBusReply<QByteArray> r = walletLauncher()->getInterface().readMap(d->handle, d->folder, key, appid());
         if (r.isValid()) {
             rc = 0;
-            QByteArray v = r;
+            v = r;
+            d->cacheValue(d->folder, key, Map, v);
             if (!v.isEmpty()) {
                 QDataStream ds(&v, QIODevice::ReadOnly);
                 ds >> value;
@@ -1343,9 +1519,39 @@ int Wallet::readPassword(const QString &key, QString &value)
             return rc;
         }
 
+        // kept as kwalletd stores it, so readEntry() can use it too
+        QByteArray v;
+        if (d->cache.value(d->folder, key, Password, v)) {
+            QDataStream ds(&v, QIODevice::ReadOnly);
+            ds >> value;
+            v.fill(0);
+            return 0;
+        }
+
+        // with the cache, the type and value are worth having for later
+        bool exists = false;
+        EntryType entryType = Unknown;
+        if (d->cache.isEnabled() && d->readEntryTyped(key, exists, entryType, v, rc)) {
+            if (rc == 0) {
+                value.clear();
+                if (entryType == Password) {
+                    QDataStream ds(&v, QIODevice::ReadOnly);
+                    ds >> value;
+                }
+            }
+            v.fill(0);
+            return rc;
+        }
+
         QDBusReply<QString> r = walletLauncher()->getInterface().readPassword(d->handle, d->folder, key, appid());
         if (r.isValid()) {
             value = r;
+            if (d->cache.isEnabled() && !value.isEmpty()) {
+                QDataStream ds(&v, QIODevice::WriteOnly);
+                ds << value;
+                d->cacheValue(d->folder, key, Password, v);
+                v.fill(0);
+            }
             rc = 0;
         }
 #if HAVE_KSECRETSSERVICE
@@ -1461,10 +1667,12 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
                 return rc;
             }
 
-            QDBusReply<int> r = walletLauncher()->getInterface().writeEntry(d->handle, d->folder, key, value, int(entryType), appid());
-            if (r.isValid()) {
-                rc = r;
+            d->cache.remove(d->folder, key);
+            if (d->writeEntryFd(key, value, entryType, rc)) {
+                return rc;
             }
+
+            rc = d->write(walletLauncher()->getInterface().writeEntry(d->handle, d->folder, key, value, int(entryType), appid()));
 #if HAVE_KSECRETSSERVICE
         }
 #endif
@@ -1485,10 +1693,12 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
                 return rc;
             }
 
-            QDBusReply<int> r = walletLauncher()->getInterface().writeEntry(d->handle, d->folder, key, value, appid());
-            if (r.isValid()) {
-                rc = r;
+            d->cache.remove(d->folder, key);
+            if (d->writeEntryFd(key, value, Stream, rc)) {
+                return rc;
             }
+
+            rc = d->write(walletLauncher()->getInterface().writeEntry(d->handle, d->folder, key, value, appid()));
 #if HAVE_KSECRETSSERVICE
         }
 #endif
@@ -1514,10 +1724,8 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
             QByteArray mapData;
             QDataStream ds(&mapData, QIODevice::WriteOnly);
             ds << value;
-            QDBusReply<int> r = walletLauncher()->getInterface().writeMap(d->handle, d->folder, key, mapData, appid());
-            if (r.isValid()) {
-                rc = r;
-            }
+            d->cache.remove(d->folder, key);
+            rc = d->write(walletLauncher()->getInterface().writeMap(d->handle, d->folder, key, mapData, appid()));
 #if HAVE_KSECRETSSERVICE
         }
 #endif
@@ -1538,10 +1746,8 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
                 return rc;
             }
 
-            QDBusReply<int> r = walletLauncher()->getInterface().writePassword(d->handle, d->folder, key, value, appid());
-            if (r.isValid()) {
-                rc = r;
-            }
+            d->cache.remove(d->folder, key);
+            rc = d->write(walletLauncher()->getInterface().writePassword(d->handle, d->folder, key, value, appid()));
 #if HAVE_KSECRETSSERVICE
         }
 #endif
@@ -1561,11 +1767,18 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
                 return false;
             }
 
+            if (d->cache.contains(d->folder, key)) {
+                return true;
+            }
+
             QDBusReply<bool> r = walletLauncher()->getInterface().hasEntry(d->handle, d->folder, key, appid());
             if (!r.isValid()) {
                 qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
                 return false;
             } else {
+                if (r.value()) {
+                    d->cache.insert(d->folder, key, Unknown, nullptr);
+                }
                 return r;
             }
 #if HAVE_KSECRETSSERVICE
@@ -1593,10 +1806,168 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
                 return rc;
             }
 
-            QDBusReply<int> r = walletLauncher()->getInterface().removeEntry(d->handle, d->folder, key, appid());
-            if (r.isValid()) {
-                rc = r;
+            d->cache.remove(d->folder, key);
+            rc = d->write(walletLauncher()->getInterface().removeEntry(d->handle, d->folder, key, appid()));
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+
+        return rc;
+    }
+
+    QMap<QString, QByteArray> Wallet::readEntries(const QStringList &keys, bool *ok) const
+    {
+        QMap<QString, QByteArray> entries;
+        bool success = false;
+
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            success = true;
+            for (const QString &key : keys) {
+                QByteArray value;
+                if (d->readEntry<QByteArray>(key, value) == 0) {
+                    entries.insert(key, value);
+                }
             }
+        } else {
+#endif
+            if (d->handle != -1) {
+                QVariantList values;
+                QDBusReply<QList<int>> r =
+                    walletLauncher()->getInterface().readEntries(d->handle, sameFolder(d->folder, keys.count()), keys, appid(), values);
+                if (r.isValid()) {
+                    success = true;
+                    const QList<int> types = r.value();
+                    for (int i = 0; i < types.count() && i < values.count(); ++i) {
+                        if (types.at(i) != Unknown) {
+                            entries.insert(keys.at(i), values.at(i).toByteArray());
+                        }
+                    }
+                }
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+
+        if (ok) {
+            *ok = success;
+        }
+        return entries;
+    }
+
+    int Wallet::writeEntries(const QMap<QString, QByteArray> &entries, EntryType entryType)
+    {
+        int rc = -1;
+
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            rc = 0;
+            for (auto it = entries.constBegin(); it != entries.constEnd() && rc == 0; ++it) {
+                rc = d->writeEntry(it.key(), it.value(), entryType);
+            }
+        } else {
+#endif
+            if (d->handle == -1) {
+                return rc;
+            }
+
+            QVariantList values;
+            QList<int> types;
+            values.reserve(entries.count());
+            types.reserve(entries.count());
+            for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+                values.append(it.value());
+                types.append(int(entryType));
+                d->cache.remove(d->folder, it.key());
+            }
+            rc = d->write(
+                walletLauncher()->getInterface().writeEntries(d->handle, sameFolder(d->folder, entries.count()), entries.keys(), values, types, appid()));
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+
+        return rc;
+    }
+
+    int Wallet::writePasswords(const QMap<QString, QString> &passwords)
+    {
+        // encoded as kwalletd does for writePassword()
+        QMap<QString, QByteArray> entries;
+        for (auto it = passwords.constBegin(); it != passwords.constEnd(); ++it) {
+            QByteArray value;
+            QDataStream ds(&value, QIODevice::WriteOnly);
+            ds << it.value();
+            entries.insert(it.key(), value);
+        }
+        return writeEntries(entries, Password);
+    }
+
+    int Wallet::removeEntries(const QStringList &keys)
+    {
+        int rc = -1;
+
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            rc = 0;
+            for (const QString &key : keys) {
+                if (removeEntry(key) != 0) {
+                    rc = -1;
+                }
+            }
+        } else {
+#endif
+            if (d->handle == -1) {
+                return rc;
+            }
+
+            for (const QString &key : keys) {
+                d->cache.remove(d->folder, key);
+            }
+            QDBusReply<QList<int>> r = walletLauncher()->getInterface().removeEntries(d->handle, sameFolder(d->folder, keys.count()), keys, appid());
+            if (r.isValid() && r.value().count() == keys.count()) {
+                rc = 0;
+                const QList<int> results = r.value();
+                for (int result : results) {
+                    if (result != 0) {
+                        rc = result;
+                    }
+                }
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+
+        return rc;
+    }
+
+    int Wallet::readEntryTyped(const QString &key, EntryType &entryType, QByteArray &value)
+    {
+        int rc = -1;
+
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            entryType = this->entryType(key);
+            value.clear();
+            rc = entryType == Unknown ? 0 : readEntry(key, value);
+        } else {
+#endif
+            if (d->handle == -1) {
+                return rc;
+            }
+
+            if (d->cache.entry(d->folder, key, entryType, value)) {
+                return 0;
+            }
+
+            bool exists = false;
+            if (d->readEntryTyped(key, exists, entryType, value, rc)) {
+                return rc;
+            }
+
+            // kwalletd from before readEntryTyped
+            entryType = this->entryType(key);
+            value.clear();
+            rc = entryType == Unknown ? 0 : readEntry(key, value);
 #if HAVE_KSECRETSSERVICE
         }
 #endif
@@ -1604,6 +1975,344 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
         return rc;
     }
 
+    void Wallet::setReadCache(int maxSize, int maxAge)
+    {
+        d->cache.setLimits(maxSize, maxAge);
+    }
+
+    quint64 Wallet::readCacheHits() const
+    {
+        return d->cache.hits();
+    }
+
+    quint64 Wallet::readCacheMisses() const
+    {
+        return d->cache.misses();
+    }
+
+    void Wallet::setWriteBehind(int window)
+    {
+        d->writeWindow = qMax(window, 0);
+        d->waitForWrites(d->writeWindow);
+    }
+
+    int Wallet::flush()
+    {
+        d->waitForWrites(0);
+        const int rc = d->writeError;
+        d->writeError = 0;
+        return rc;
+    }
+
+    void Wallet::readEntryAsync(const QString &key, const std::function<void(int, const QByteArray &)> &callback)
+    {
+        QByteArray value;
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const int rc = readEntry(key, value);
+            d->later([callback, rc, value]() {
+                callback(rc, value);
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    callback(-1, QByteArray());
+                });
+            } else if (d->cache.value(d->folder, key, Unknown, value)) {
+                d->later([callback, value]() {
+                    callback(0, value);
+                });
+            } else {
+                d->readEntryAsync(d->folder, key, callback);
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::readPasswordAsync(const QString &key, const std::function<void(int, const QString &)> &callback)
+    {
+        QByteArray v;
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            QString value;
+            const int rc = readPassword(key, value);
+            d->later([callback, rc, value]() {
+                callback(rc, value);
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    callback(-1, QString());
+                });
+            } else if (d->cache.value(d->folder, key, Password, v)) {
+                QString value;
+                QDataStream ds(&v, QIODevice::ReadOnly);
+                ds >> value;
+                v.fill(0);
+                d->later([callback, value]() {
+                    callback(0, value);
+                });
+            } else {
+                const QString folder = d->folder;
+                const quint64 generation = d->cache.generation();
+                d->whenReplied(walletLauncher()->getInterface().readPassword(d->handle, folder, key, appid()),
+                               [this, folder, key, generation, callback](const QDBusPendingReply<QString> &r) {
+                                   if (r.isError()) {
+                                       callback(-1, QString());
+                                       return;
+                                   }
+                                   const QString value = r.value();
+                                   if (d->cache.isEnabled() && d->cache.generation() == generation && !value.isEmpty()) {
+                                       QByteArray v;
+                                       QDataStream ds(&v, QIODevice::WriteOnly);
+                                       ds << value;
+                                       d->cacheValue(folder, key, Password, v);
+                                       v.fill(0);
+                                   }
+                                   callback(0, value);
+                               });
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::readMapAsync(const QString &key, const std::function<void(int, const QMap<QString, QString> &)> &callback)
+    {
+        QByteArray v;
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            QMap<QString, QString> value;
+            const int rc = readMap(key, value);
+            d->later([callback, rc, value]() {
+                callback(rc, value);
+            });
+        } else {
+#endif
+            registerTypes();
+
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    callback(-1, QMap<QString, QString>());
+                });
+            } else if (d->cache.value(d->folder, key, Map, v)) {
+                QMap<QString, QString> value;
+                QDataStream ds(&v, QIODevice::ReadOnly);
+                ds >> value;
+                v.fill(0);
+                d->later([callback, value]() {
+                    callback(0, value);
+                });
+            } else {
+                const QString folder = d->folder;
+                const quint64 generation = d->cache.generation();
+                d->whenReplied(walletLauncher()->getInterface().readMap(d->handle, folder, key, appid()),
+                               [this, folder, key, generation, callback](const QDBusPendingReply<QByteArray> &r) {
+                                   QMap<QString, QString> value;
+                                   if (r.isError()) {
+                                       callback(-1, value);
+                                       return;
+                                   }
+                                   QByteArray v = r.value();
+                                   if (d->cache.generation() == generation) {
+                                       d->cacheValue(folder, key, Map, v);
+                                   }
+                                   if (!v.isEmpty()) {
+                                       QDataStream ds(&v, QIODevice::ReadOnly);
+                                       ds >> value;
+                                   }
+                                   callback(0, value);
+                               });
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::entryListAsync(const std::function<void(int, const QStringList &)> &callback)
+    {
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const QStringList list = entryList();
+            d->later([callback, list]() {
+                callback(0, list);
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    callback(-1, QStringList());
+                });
+            } else {
+                d->whenReplied(walletLauncher()->getInterface().entryList(d->handle, d->folder, appid()), [callback](const QDBusPendingReply<QStringList> &r) {
+                    if (r.isError()) {
+                        qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
+                        callback(-1, QStringList());
+                    } else {
+                        callback(0, r.value());
+                    }
+                });
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::folderListAsync(const std::function<void(int, const QStringList &)> &callback)
+    {
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const QStringList list = folderList();
+            d->later([callback, list]() {
+                callback(0, list);
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    callback(-1, QStringList());
+                });
+            } else {
+                d->whenReplied(walletLauncher()->getInterface().folderList(d->handle, appid()), [callback](const QDBusPendingReply<QStringList> &r) {
+                    if (r.isError()) {
+                        qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
+                        callback(-1, QStringList());
+                    } else {
+                        callback(0, r.value());
+                    }
+                });
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    // The callbacks of the writes may be empty.
+    static std::function<void(const QDBusPendingReply<int> &)> replyToWrite(const std::function<void(int)> &callback)
+    {
+        return [callback](const QDBusPendingReply<int> &r) {
+            if (callback) {
+                callback(r.isError() ? -1 : r.value());
+            }
+        };
+    }
+
+    void Wallet::writeEntryAsync(const QString &key, const QByteArray &value, EntryType entryType, const std::function<void(int)> &callback)
+    {
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const int rc = writeEntry(key, value, entryType);
+            d->later([callback, rc]() {
+                if (callback) {
+                    callback(rc);
+                }
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    if (callback) {
+                        callback(-1);
+                    }
+                });
+            } else {
+                d->cache.remove(d->folder, key);
+                d->writeEntryAsync(d->folder, key, value, entryType, callback);
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::writePasswordAsync(const QString &key, const QString &value, const std::function<void(int)> &callback)
+    {
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const int rc = writePassword(key, value);
+            d->later([callback, rc]() {
+                if (callback) {
+                    callback(rc);
+                }
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    if (callback) {
+                        callback(-1);
+                    }
+                });
+            } else {
+                d->cache.remove(d->folder, key);
+                d->whenReplied(walletLauncher()->getInterface().writePassword(d->handle, d->folder, key, value, appid()), replyToWrite(callback));
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::writeMapAsync(const QString &key, const QMap<QString, QString> &value, const std::function<void(int)> &callback)
+    {
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const int rc = writeMap(key, value);
+            d->later([callback, rc]() {
+                if (callback) {
+                    callback(rc);
+                }
+            });
+        } else {
+#endif
+            registerTypes();
+
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    if (callback) {
+                        callback(-1);
+                    }
+                });
+            } else {
+                QByteArray mapData;
+                QDataStream ds(&mapData, QIODevice::WriteOnly);
+                ds << value;
+                d->cache.remove(d->folder, key);
+                d->whenReplied(walletLauncher()->getInterface().writeMap(d->handle, d->folder, key, mapData, appid()), replyToWrite(callback));
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
+    void Wallet::removeEntryAsync(const QString &key, const std::function<void(int)> &callback)
+    {
+#if HAVE_KSECRETSSERVICE
+        if (walletLauncher()->m_useKSecretsService) {
+            const int rc = removeEntry(key);
+            d->later([callback, rc]() {
+                if (callback) {
+                    callback(rc);
+                }
+            });
+        } else {
+#endif
+            if (d->handle == -1) {
+                d->later([callback]() {
+                    if (callback) {
+                        callback(-1);
+                    }
+                });
+            } else {
+                d->cache.remove(d->folder, key);
+                d->whenReplied(walletLauncher()->getInterface().removeEntry(d->handle, d->folder, key, appid()), replyToWrite(callback));
+            }
+#if HAVE_KSECRETSSERVICE
+        }
+#endif
+    }
+
     Wallet::EntryType Wallet::entryType(const QString &key)
     {
         int rc = 0;
@@ -1634,9 +2343,17 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
                 return Wallet::Unknown;
             }
 
+            EntryType cached;
+            if (d->cache.type(d->folder, key, cached)) {
+                return cached;
+            }
+
             QDBusReply<int> r = walletLauncher()->getInterface().entryType(d->handle, d->folder, key, appid());
             if (r.isValid()) {
                 rc = r;
+                if (rc != Unknown) {
+                    d->cache.insert(d->folder, key, static_cast<EntryType>(rc), nullptr);
+                }
             }
 #if HAVE_KSECRETSSERVICE
         }
@@ -1644,6 +2361,152 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
         return static_cast<EntryType>(rc);
     }
 
+    bool Wallet::WalletPrivate::readEntryTyped(const QString &key, bool &exists, Wallet::EntryType &entryType, QByteArray &value, int &rc)
+    {
+        if (!walletLauncher()->m_useReadEntryTyped) {
+            return false;
+        }
+
+        int type = Unknown;
+        QDBusReply<bool> r = walletLauncher()->getInterface().readEntryTyped(handle, folder, key, appid(), type, value);
+        if (!r.isValid()) {
+            if (r.error().type() == QDBusError::UnknownMethod) {
+                walletLauncher()->m_useReadEntryTyped = false;
+                return false;
+            }
+            qCDebug(KWALLET_API_LOG) << "Invalid DBus reply: " << r.error();
+            rc = -1;
+            return true;
+        }
+
+        exists = r.value();
+        entryType = exists ? static_cast<Wallet::EntryType>(type) : Unknown;
+        if (exists) {
+            // it is known to exist, so even an empty value is kept
+            cache.insert(folder, key, entryType, &value);
+        }
+        rc = 0;
+        return true;
+    }
+
+    bool Wallet::WalletPrivate::writeEntryFd(const QString &key, const QByteArray &value, Wallet::EntryType entryType, int &rc)
+    {
+        if (value.size() < FdThreshold || !walletLauncher()->m_useFds) {
+            return false;
+        }
+        const QDBusUnixFileDescriptor fd = valueToFd(value);
+        if (!fd.isValid()) {
+            return false;
+        }
+
+        QDBusReply<int> r = walletLauncher()->getInterface().writeEntryFd(handle, folder, key, fd, int(entryType), appid());
+        if (r.isValid()) {
+            walletLauncher()->m_fdsChecked = true;
+            rc = r;
+            return true;
+        }
+        if (r.error().type() == QDBusError::UnknownMethod) {
+            walletLauncher()->m_useFds = false;
+            return false;
+        }
+        rc = -1;
+        return true;
+    }
+
+    int Wallet::WalletPrivate::write(const QDBusPendingReply<int> &call)
+    {
+        if (writeWindow == 0) {
+            QDBusReply<int> r = call;
+            return r.isValid() ? r.value() : -1;
+        }
+
+        pendingWrites.append(call);
+        waitForWrites(writeWindow);
+        return 0;
+    }
+
+    void Wallet::WalletPrivate::waitForWrites(int keep)
+    {
+        // the replies come in order, so those which are there already
+        // are taken as well
+        while (!pendingWrites.isEmpty() && (pendingWrites.count() > keep || pendingWrites.first().isFinished())) {
+            QDBusPendingReply<int> r = pendingWrites.takeFirst();
+            r.waitForFinished();
+            const int rc = r.isError() ? -1 : r.value();
+            if (rc != 0 && writeError == 0) {
+                writeError = rc;
+            }
+        }
+    }
+
+    void Wallet::WalletPrivate::finishWrites()
+    {
+        waitForWrites(0);
+        if (writeError != 0) {
+            qCWarning(KWALLET_API_LOG) << "A write to the wallet" << name << "failed with" << writeError << "and the error wasn't collected with flush()";
+            writeError = 0;
+        }
+    }
+
+    void Wallet::WalletPrivate::readEntryAsync(const QString &folder, const QString &key, const std::function<void(int, const QByteArray &)> &callback)
+    {
+        const quint64 generation = cache.generation();
+        auto done = [this, folder, key, generation, callback](int rc, const QByteArray &value) {
+            if (rc == 0 && cache.generation() == generation) {
+                cacheValue(folder, key, Unknown, value);
+            }
+            callback(rc, value);
+        };
+
+        if (walletLauncher()->canUseFdsAsync()) {
+            whenReplied(walletLauncher()->getInterface().readEntryFd(handle, folder, key, appid()),
+                        [callback, done](const QDBusPendingReply<QDBusVariant> &r) {
+                            QByteArray value;
+                            if (r.isError()) {
+                                callback(-1, value);
+                                return;
+                            }
+                            // large values come in a memfd
+                            const QVariant v = r.value().variant();
+                            if (v.userType() == qMetaTypeId<QDBusUnixFileDescriptor>()) {
+                                if (!valueFromFd(v.value<QDBusUnixFileDescriptor>(), value)) {
+                                    callback(-1, value);
+                                    return;
+                                }
+                            } else {
+                                value = v.toByteArray();
+                            }
+                            done(0, value);
+                        });
+            return;
+        }
+
+        whenReplied(walletLauncher()->getInterface().readEntry(handle, folder, key, appid()), [done](const QDBusPendingReply<QByteArray> &r) {
+            if (r.isError()) {
+                done(-1, QByteArray());
+            } else {
+                done(0, r.value());
+            }
+        });
+    }
+
+    void Wallet::WalletPrivate::writeEntryAsync(const QString &folder,
+                                                const QString &key,
+                                                const QByteArray &value,
+                                                Wallet::EntryType entryType,
+                                                const std::function<void(int)> &callback)
+    {
+        if (value.size() >= FdThreshold && walletLauncher()->canUseFdsAsync()) {
+            const QDBusUnixFileDescriptor fd = valueToFd(value);
+            if (fd.isValid()) {
+                whenReplied(walletLauncher()->getInterface().writeEntryFd(handle, folder, key, fd, int(entryType), appid()), replyToWrite(callback));
+                return;
+            }
+        }
+
+        whenReplied(walletLauncher()->getInterface().writeEntry(handle, folder, key, value, int(entryType), appid()), replyToWrite(callback));
+    }
+
     void Wallet::WalletPrivate::walletServiceUnregistered()
     {
         if (handle >= 0) {
@@ -1660,6 +2523,11 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
         } else {
 #endif
             if (d->name == wallet) {
+                d->cache.removeFolder(folder);
+                // writing to a folder creates it
+                if (d->foldersKnown) {
+                    d->folders.insert(folder);
+                }
                 Q_EMIT folderUpdated(folder);
             }
 #if HAVE_KSECRETSSERVICE
@@ -1676,6 +2544,8 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
         } else {
 #endif
             if (d->name == wallet) {
+                d->cache.clear();
+                d->forgetFolders();
                 Q_EMIT folderListUpdated();
             }
 #if HAVE_KSECRETSSERVICE
@@ -1796,6 +2666,10 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
         : m_wallet_deamon(nullptr)
         , m_cgroup(KSharedConfig::openConfig(QStringLiteral("kwalletrc"), KConfig::NoGlobals)->group("Wallet"))
         , m_walletEnabled(false)
+        , m_useFds(QDBusConnection::sessionBus().connectionCapabilities() & QDBusConnection::UnixFileDescriptorPassing)
+        , m_fdsChecked(false)
+        , m_checkingFds(false)
+        , m_useReadEntryTyped(true)
     {
         m_useKSecretsService = m_cgroup.readEntry("UseKSecretsService", false);
         m_walletEnabled = m_cgroup.readEntry("Enabled", true);
@@ -1849,6 +2723,28 @@ QMap<QString, QString> Wallet::passwordList(bool *ok) const
         return *m_wallet_deamon;
     }
 
+    bool KWalletDLauncher::canUseFdsAsync()
+    {
+        if (!m_useFds || m_fdsChecked) {
+            return m_useFds;
+        }
+        if (!m_checkingFds) {
+            m_checkingFds = true;
+            // the handle 0 is no wallet's, so this reads nothing
+            QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(getInterface().readEntryFd(0, QString(), QString(), appid()));
+            QObject::connect(watcher, &QDBusPendingCallWatcher::finished, watcher, [this, watcher]() {
+                watcher->deleteLater();
+                m_checkingFds = false;
+                if (!watcher->isError()) {
+                    m_fdsChecked = true;
+                } else if (watcher->error().type() == QDBusError::UnknownMethod) {
+                    m_useFds = false;
+                }
+            });
+        }
+        return false;
+    }
+
 } // namespace KWallet
 
 #include "moc_kwallet.cpp"
@@ -15,6 +15,8 @@
 
 #include <kwallet_export.h>
 
+#include <functional>
+
 /**
  * NOTE: KSecretsService folder semantics
  * The KWallet API uses folders for organising items. KSecretsService does not
@@ -470,6 +472,221 @@ public:
      */
     virtual int removeEntry(const QString &key);
 
+    /**
+     *  Read the entries @p keys of the current folder, all in a single
+     *  call to the wallet service.
+     *
+     *  @param keys The keys of the entries to read.
+     *  @param ok if not nullptr, the object this parameter points to will be set
+     *            to true to indicate success or false otherwise
+     *  @return a map of key/value pairs for the entries which exist
+     *
+     *  @since 5.83
+     */
+    QMap<QString, QByteArray> readEntries(const QStringList &keys, bool *ok) const;
+
+    /**
+     *  Write the entries in @p entries to the current folder, all in a
+     *  single call to the wallet service. Either all of them are written
+     *  or none is.
+     *
+     *  @param entries The keys and values of the entries.
+     *  @param entryType The type of the entries.
+     *  @return Returns 0 on success, non-zero on error.
+     *
+     *  @since 5.83
+     */
+    int writeEntries(const QMap<QString, QByteArray> &entries, EntryType entryType = Stream);
+
+    /**
+     *  Write the passwords in @p passwords to the current folder, all in
+     *  a single call to the wallet service. Either all of them are written
+     *  or none is.
+     *
+     *  @param passwords The keys and values of the passwords.
+     *  @return Returns 0 on success, non-zero on error.
+     *
+     *  @since 5.83
+     */
+    int writePasswords(const QMap<QString, QString> &passwords);
+
+    /**
+     *  Remove the entries @p keys from the current folder, all in a single
+     *  call to the wallet service.
+     *
+     *  @param keys The keys to remove.
+     *  @return Returns 0 if all of them were removed, non-zero on error.
+     *
+     *  @since 5.83
+     */
+    int removeEntries(const QStringList &keys);
+
+    /**
+     *  Read the entry @p key of the current folder together with its type,
+     *  in a single call to the wallet service.
+     *
+     *  The value always comes in the reply itself, so readEntry(), which can
+     *  pass large values in a file descriptor, is cheaper for those.
+     *
+     *  @param key The key of the entry to read.
+     *  @param entryType Set to the type of the entry, Unknown if there is
+     *                   no such entry.
+     *  @param value Set to the value of the entry, empty if there is no
+     *               such entry.
+     *  @return Returns 0 on success, non-zero on error.
+     *
+     *  @since 5.83
+     */
+    int readEntryTyped(const QString &key, EntryType &entryType, QByteArray &value);
+
+    /**
+     *  Keep the entries read from this wallet in memory, so reading them
+     *  again doesn't need the wallet service. The cache is off by default.
+     *
+     *  The values are kept in memory locked against swapping and wiped
+     *  when dropped; entries which can't be locked are not kept. Changes
+     *  made through this object are seen at once, changes by other
+     *  applications once the wallet service signals them, but never later
+     *  than @p maxAge.
+     *
+     *  @param maxSize The memory the cache may use in bytes, 0 to disable it.
+     *  @param maxAge How long an entry is kept in milliseconds.
+     *
+     *  @since 5.83
+     */
+    void setReadCache(int maxSize, int maxAge = 60000);
+
+    /**
+     *  The number of reads answered from the read cache.
+     *  @see setReadCache()
+     *  @since 5.83
+     */
+    quint64 readCacheHits() const;
+
+    /**
+     *  The number of reads the read cache couldn't answer.
+     *  @see setReadCache()
+     *  @since 5.83
+     */
+    quint64 readCacheMisses() const;
+
+    /**
+     *  Don't wait for the replies to writeEntry(), writePassword(),
+     *  writeMap(), removeEntry() and writeEntries(), up to @p window of
+     *  them at a time. These then return 0 at once, and their errors are
+     *  reported by flush(). Reads still see the writes made before them.
+     *
+     *  This makes writing many entries much faster.
+     *
+     *  Closing the wallet, by lockWallet(), deleting this object or the
+     *  wallet service, waits for the writes still in flight. An error
+     *  flush() didn't report by then is only logged.
+     *
+     *  @param window The number of writes to have in flight, 0 to wait
+     *                for each of them, the default.
+     *  @since 5.83
+     */
+    void setWriteBehind(int window);
+
+    /**
+     *  Wait for the replies to the writes sent since setWriteBehind().
+     *  @return Returns 0 if all of them succeeded, else the error of the
+     *          first one that failed.
+     *  @since 5.83
+     */
+    int flush();
+
+    /**
+     *  Read the entry @p key from the current folder without waiting for
+     *  the wallet service. @p callback is called from the event loop with
+     *  0 and the value on success, or a non-zero error code. It isn't called
+     *  if this object is deleted first.
+     *
+     *  Several calls may be in flight at once. The folder is the one current
+     *  when the call is made.
+     *
+     *  @see readEntry()
+     *  @since 5.83
+     */
+    void readEntryAsync(const QString &key, const std::function<void(int, const QByteArray &)> &callback);
+
+    /**
+     *  Read the password entry @p key from the current folder without
+     *  waiting for the wallet service, like readEntryAsync().
+     *
+     *  @see readPassword()
+     *  @since 5.83
+     */
+    void readPasswordAsync(const QString &key, const std::function<void(int, const QString &)> &callback);
+
+    /**
+     *  Read the map entry @p key from the current folder without waiting
+     *  for the wallet service, like readEntryAsync().
+     *
+     *  @see readMap()
+     *  @since 5.83
+     */
+    void readMapAsync(const QString &key, const std::function<void(int, const QMap<QString, QString> &)> &callback);
+
+    /**
+     *  Get the list of the entries of the current folder without waiting
+     *  for the wallet service, like readEntryAsync().
+     *
+     *  @see entryList()
+     *  @since 5.83
+     */
+    void entryListAsync(const std::function<void(int, const QStringList &)> &callback);
+
+    /**
+     *  Get the list of the folders of this wallet without waiting for the
+     *  wallet service, like readEntryAsync().
+     *
+     *  @see folderList()
+     *  @since 5.83
+     */
+    void folderListAsync(const std::function<void(int, const QStringList &)> &callback);
+
+    /**
+     *  Write @p value to the entry @p key of the current folder without
+     *  waiting for the wallet service. @p callback, if given, is called from
+     *  the event loop with 0 on success or a non-zero error code. It isn't
+     *  called if this object is deleted first.
+     *
+     *  The calls made through this object reach the wallet service in the
+     *  order they are made, so a read after this one sees the new value.
+     *
+     *  @see writeEntry()
+     *  @since 5.83
+     */
+    void writeEntryAsync(const QString &key, const QByteArray &value, EntryType entryType, const std::function<void(int)> &callback = {});
+
+    /**
+     *  Write the password @p value to the entry @p key of the current folder
+     *  without waiting for the wallet service, like writeEntryAsync().
+     *
+     *  @see writePassword()
+     *  @since 5.83
+     */
+    void writePasswordAsync(const QString &key, const QString &value, const std::function<void(int)> &callback = {});
+
+    /**
+     *  Write the map @p value to the entry @p key of the current folder
+     *  without waiting for the wallet service, like writeEntryAsync().
+     *
+     *  @see writeMap()
+     *  @since 5.83
+     */
+    void writeMapAsync(const QString &key, const QMap<QString, QString> &value, const std::function<void(int)> &callback = {});
+
+    /**
+     *  Remove the entry @p key from the current folder without waiting for
+     *  the wallet service, like writeEntryAsync().
+     *
+     *  @see removeEntry()
+     *  @since 5.83
+     */
+    void removeEntryAsync(const QString &key, const std::function<void(int)> &callback = {});
+
     /**
      *  Determine the type of the entry @p key in this folder.
      *  @param key The key to look up.
@@ -422,28 +422,34 @@ const QString &Wallet::currentFolder() const
     return d->folder;
 }
 
-int Wallet::readEntry(const QString &key, QByteArray &value)
+static OSStatus readEntryImplementation(const QString &walletName, const QString &key, QByteArray &value)
 {
-    const QByteArray serviceName(walletName().toUtf8());
+    const QByteArray serviceName(walletName.toUtf8());
     const QByteArray accountName(key.toUtf8());
     UInt32 passwordSize = 0;
     void *passwordData = 0;
+    const OSStatus err = SecKeychainFindGenericPassword(NULL,
+                                                        serviceName.size(),
+                                                        serviceName.constData(),
+                                                        accountName.size(),
+                                                        accountName.constData(),
+                                                        &passwordSize,
+                                                        &passwordData,
+                                                        NULL);
+    if (err == noErr) {
+        value = QByteArray(reinterpret_cast<const char *>(passwordData), passwordSize);
+        SecKeychainItemFreeContent(NULL, passwordData);
+    }
+    return err;
+}
+
+int Wallet::readEntry(const QString &key, QByteArray &value)
+{
     QString errMsg;
-    if (isError(SecKeychainFindGenericPassword(NULL,
-                                               serviceName.size(),
-                                               serviceName.constData(),
-                                               accountName.size(),
-                                               accountName.constData(),
-                                               &passwordSize,
-                                               &passwordData,
-                                               NULL),
-                &errMsg)) {
+    if (isError(readEntryImplementation(walletName(), key, value), &errMsg)) {
         qWarning() << "Could not retrieve password:" << qPrintable(errMsg);
         return -1;
     }
-
-    value = QByteArray(reinterpret_cast<const char *>(passwordData), passwordSize);
-    SecKeychainItemFreeContent(NULL, passwordData);
     return 0;
 }
 
@@ -621,6 +627,226 @@ int Wallet::removeEntry(const QString &key)
     return removeEntryImplementation(walletName(), key);
 }
 
+// The keychain has no batch calls, these go through the entries one by one.
+// A failed write leaves the entries written before it in place.
+QMap<QString, QByteArray> Wallet::readEntries(const QStringList &keys, bool *ok) const
+{
+    QMap<QString, QByteArray> entries;
+    bool success = true;
+    for (const QString &key : keys) {
+        QByteArray value;
+        QString errMsg;
+        const OSStatus err = readEntryImplementation(walletName(), key, value);
+        if (err == errSecItemNotFound) {
+            continue;
+        }
+        if (isError(err, &errMsg)) {
+            qWarning() << "Could not retrieve password:" << qPrintable(errMsg);
+            success = false;
+            break;
+        }
+        entries.insert(key, value);
+    }
+
+    if (ok) {
+        *ok = success;
+    }
+    return entries;
+}
+
+int Wallet::writeEntries(const QMap<QString, QByteArray> &entries, EntryType entryType)
+{
+    int rc = 0;
+    for (auto it = entries.constBegin(); it != entries.constEnd() && rc == 0; ++it) {
+        rc = writeEntry(it.key(), it.value(), entryType);
+    }
+    return rc;
+}
+
+int Wallet::writePasswords(const QMap<QString, QString> &passwords)
+{
+    int rc = 0;
+    for (auto it = passwords.constBegin(); it != passwords.constEnd() && rc == 0; ++it) {
+        rc = writePassword(it.key(), it.value());
+    }
+    return rc;
+}
+
+int Wallet::removeEntries(const QStringList &keys)
+{
+    int rc = 0;
+    for (const QString &key : keys) {
+        const int result = removeEntry(key);
+        if (result != 0) {
+            rc = result;
+        }
+    }
+    return rc;
+}
+
+int Wallet::readEntryTyped(const QString &key, EntryType &entryType, QByteArray &value)
+{
+    value.clear();
+    QString errMsg;
+    const OSStatus err = readEntryImplementation(walletName(), key, value);
+    if (err == errSecItemNotFound) {
+        entryType = Unknown;
+        return 0;
+    }
+    if (isError(err, &errMsg)) {
+        qWarning() << "Could not retrieve password:" << qPrintable(errMsg);
+        entryType = Unknown;
+        return -1;
+    }
+
+    // the keychain keeps no types, its items are plain data
+    entryType = this->entryType(key);
+    if (entryType == Unknown) {
+        entryType = Stream;
+    }
+    return 0;
+}
+
+// Every read goes to the keychain, there is no cache to set up.
+void Wallet::setReadCache(int maxSize, int maxAge)
+{
+    Q_UNUSED(maxSize)
+    Q_UNUSED(maxAge)
+}
+
+quint64 Wallet::readCacheHits() const
+{
+    return 0;
+}
+
+quint64 Wallet::readCacheMisses() const
+{
+    return 0;
+}
+
+// Writes to the keychain are done by the time they return.
+void Wallet::setWriteBehind(int window)
+{
+    Q_UNUSED(window)
+}
+
+int Wallet::flush()
+{
+    return 0;
+}
+
+// The keychain is only called synchronously, the callbacks still come from
+// the event loop, as they do with the wallet service.
+void Wallet::readEntryAsync(const QString &key, const std::function<void(int, const QByteArray &)> &callback)
+{
+    QByteArray value;
+    const int rc = readEntry(key, value);
+    QMetaObject::invokeMethod(
+        this,
+        [callback, rc, value]() {
+            callback(rc, value);
+        },
+        Qt::QueuedConnection);
+}
+
+void Wallet::readPasswordAsync(const QString &key, const std::function<void(int, const QString &)> &callback)
+{
+    QString value;
+    const int rc = readPassword(key, value);
+    QMetaObject::invokeMethod(
+        this,
+        [callback, rc, value]() {
+            callback(rc, value);
+        },
+        Qt::QueuedConnection);
+}
+
+void Wallet::readMapAsync(const QString &key, const std::function<void(int, const QMap<QString, QString> &)> &callback)
+{
+    QMap<QString, QString> value;
+    const int rc = readMap(key, value);
+    QMetaObject::invokeMethod(
+        this,
+        [callback, rc, value]() {
+            callback(rc, value);
+        },
+        Qt::QueuedConnection);
+}
+
+void Wallet::entryListAsync(const std::function<void(int, const QStringList &)> &callback)
+{
+    const QStringList list = entryList();
+    QMetaObject::invokeMethod(
+        this,
+        [callback, list]() {
+            callback(0, list);
+        },
+        Qt::QueuedConnection);
+}
+
+void Wallet::folderListAsync(const std::function<void(int, const QStringList &)> &callback)
+{
+    const QStringList list = folderList();
+    QMetaObject::invokeMethod(
+        this,
+        [callback, list]() {
+            callback(0, list);
+        },
+        Qt::QueuedConnection);
+}
+
+void Wallet::writeEntryAsync(const QString &key, const QByteArray &value, EntryType entryType, const std::function<void(int)> &callback)
+{
+    const int rc = writeEntry(key, value, entryType);
+    if (callback) {
+        QMetaObject::invokeMethod(
+            this,
+            [callback, rc]() {
+                callback(rc);
+            },
+            Qt::QueuedConnection);
+    }
+}
+
+void Wallet::writePasswordAsync(const QString &key, const QString &value, const std::function<void(int)> &callback)
+{
+    const int rc = writePassword(key, value);
+    if (callback) {
+        QMetaObject::invokeMethod(
+            this,
+            [callback, rc]() {
+                callback(rc);
+            },
+            Qt::QueuedConnection);
+    }
+}
+
+void Wallet::writeMapAsync(const QString &key, const QMap<QString, QString> &value, const std::function<void(int)> &callback)
+{
+    const int rc = writeMap(key, value);
+    if (callback) {
+        QMetaObject::invokeMethod(
+            this,
+            [callback, rc]() {
+                callback(rc);
+            },
+            Qt::QueuedConnection);
+    }
+}
+
+void Wallet::removeEntryAsync(const QString &key, const std::function<void(int)> &callback)
+{
+    const int rc = removeEntry(key);
+    if (callback) {
+        QMetaObject::invokeMethod(
+            this,
+            [callback, rc]() {
+                callback(rc);
+            },
+            Qt::QueuedConnection);
+    }
+}
+
 Wallet::EntryType Wallet::entryType(const QString &key)
 {
 #ifdef OSX_KEYCHAIN_PORT_DISABLED
@@ -0,0 +1,231 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletcache_p.h"
+
+#include <QDeadlineTimer>
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace KWallet;
+
+class WalletCache::Item
+{
+public:
+    Item(Wallet::EntryType type, const QByteArray *value, const QDeadlineTimer &expiry)
+        : type(type)
+        , expiry(expiry)
+    {
+        if (value) {
+            lock(*value);
+        } else {
+            _valid = true;
+        }
+    }
+
+    ~Item()
+    {
+#ifdef Q_OS_UNIX
+        if (_data) {
+            // not a memset(), which may be left out before freeing
+            volatile char *p = _data;
+            for (size_t i = 0; i < _mapped; ++i) {
+                p[i] = 0;
+            }
+            munlock(_data, _mapped);
+            munmap(_data, _mapped);
+        }
+#endif
+    }
+
+    // False if the memory of the value couldn't be locked.
+    bool isValid() const
+    {
+        return _valid;
+    }
+
+    bool hasValue() const
+    {
+        return _data != nullptr;
+    }
+
+    QByteArray value() const
+    {
+        return QByteArray(_data, _size);
+    }
+
+    int cost(const Key &key) const
+    {
+        return int(_mapped) + (key.first.size() + key.second.size()) * 2 + int(sizeof(Item));
+    }
+
+    Wallet::EntryType type;
+    QDeadlineTimer expiry;
+
+private:
+    Q_DISABLE_COPY(Item)
+
+    void lock(const QByteArray &value)
+    {
+#ifdef Q_OS_UNIX
+        // pages of its own, as the locks of a page don't add up
+        const size_t page = sysconf(_SC_PAGESIZE);
+        const size_t length = (qMax(value.size(), 1) + page - 1) / page * page;
+        void *data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return;
+        }
+        if (mlock(data, length) != 0) {
+            munmap(data, length);
+            return;
+        }
+#ifdef MADV_DONTDUMP
+        madvise(data, length, MADV_DONTDUMP);
+#endif
+        _data = static_cast<char *>(data);
+        _mapped = length;
+        _size = value.size();
+        memcpy(_data, value.constData(), _size);
+        _valid = true;
+#else
+        Q_UNUSED(value);
+#endif
+    }
+
+    char *_data = nullptr;
+    int _size = 0;
+    size_t _mapped = 0;
+    bool _valid = false;
+};
+
+WalletCache::WalletCache()
+{
+    _items.setMaxCost(0);
+}
+
+WalletCache::~WalletCache() = default;
+
+void WalletCache::setLimits(int maxSize, int maxAge)
+{
+    _items.setMaxCost(qMax(maxSize, 0));
+    _maxAge = maxAge;
+    if (!isEnabled()) {
+        clear();
+    }
+}
+
+WalletCache::Item *WalletCache::find(const QString &folder, const QString &key)
+{
+    const Key k(folder, key);
+    Item *item = _items.object(k);
+    if (item && item->expiry.hasExpired()) {
+        _items.remove(k);
+        return nullptr;
+    }
+    return item;
+}
+
+bool WalletCache::count(bool hit)
+{
+    if (isEnabled()) {
+        ++(hit ? _hits : _misses);
+    }
+    return hit;
+}
+
+bool WalletCache::value(const QString &folder, const QString &key, Wallet::EntryType type, QByteArray &value)
+{
+    const Item *item = find(folder, key);
+    if (!item || !item->hasValue() || (type != Wallet::Unknown && item->type != type)) {
+        return count(false);
+    }
+    value = item->value();
+    return count(true);
+}
+
+bool WalletCache::type(const QString &folder, const QString &key, Wallet::EntryType &type)
+{
+    const Item *item = find(folder, key);
+    if (!item || item->type == Wallet::Unknown) {
+        return count(false);
+    }
+    type = item->type;
+    return count(true);
+}
+
+bool WalletCache::entry(const QString &folder, const QString &key, Wallet::EntryType &type, QByteArray &value)
+{
+    const Item *item = find(folder, key);
+    if (!item || item->type == Wallet::Unknown || !item->hasValue()) {
+        return count(false);
+    }
+    type = item->type;
+    value = item->value();
+    return count(true);
+}
+
+bool WalletCache::contains(const QString &folder, const QString &key)
+{
+    return count(find(folder, key) != nullptr);
+}
+
+void WalletCache::insert(const QString &folder, const QString &key, Wallet::EntryType type, const QByteArray *value)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    QDeadlineTimer expiry(_maxAge);
+    QByteArray known;
+    if (const Item *old = find(folder, key)) {
+        if (type == Wallet::Unknown) {
+            type = old->type;
+        }
+        if (!value && old->hasValue()) {
+            known = old->value();
+            value = &known;
+            expiry = old->expiry;
+        }
+    }
+
+    const Key k(folder, key);
+    Item *item = new Item(type, value, expiry);
+    known.fill(0);
+    if (item->isValid()) {
+        _items.insert(k, item, item->cost(k));
+    } else {
+        delete item;
+        _items.remove(k);
+    }
+}
+
+void WalletCache::remove(const QString &folder, const QString &key)
+{
+    ++_generation;
+    _items.remove(Key(folder, key));
+}
+
+void WalletCache::removeFolder(const QString &folder)
+{
+    ++_generation;
+    const QList<Key> keys = _items.keys();
+    for (const Key &k : keys) {
+        if (k.first == folder) {
+            _items.remove(k);
+        }
+    }
+}
+
+void WalletCache::clear()
+{
+    ++_generation;
+    _items.clear();
+}
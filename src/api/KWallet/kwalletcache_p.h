@@ -0,0 +1,94 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETCACHE_P_H
+#define _KWALLETCACHE_P_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QPair>
+#include <QString>
+
+#include "kwallet.h"
+
+namespace KWallet
+{
+/**
+ * @internal
+ * The entries read from a wallet, see Wallet::setReadCache(). The values
+ * are kept in memory locked against swapping, and wiped when they are
+ * dropped. Entries whose memory can't be locked aren't kept.
+ *
+ * The type of an entry may be known without its value, from
+ * Wallet::entryType(), and its value without its type, from
+ * Wallet::readEntry().
+ */
+class WalletCache
+{
+public:
+    WalletCache();
+    ~WalletCache();
+
+    // Disables the cache if @p maxSize is 0.
+    void setLimits(int maxSize, int maxAge);
+    bool isEnabled() const
+    {
+        return _maxAge > 0 && _items.maxCost() > 0;
+    }
+
+    // These count a hit if the entry is cached with what is asked for, a
+    // miss otherwise.
+    // The value of the entry, which must have @p type unless it is Unknown.
+    bool value(const QString &folder, const QString &key, Wallet::EntryType type, QByteArray &value);
+    // The type of the entry, if known.
+    bool type(const QString &folder, const QString &key, Wallet::EntryType &type);
+    // Both, if both are known.
+    bool entry(const QString &folder, const QString &key, Wallet::EntryType &type, QByteArray &value);
+    bool contains(const QString &folder, const QString &key);
+
+    // What was learned about an entry. @p type may be Unknown and @p value
+    // null, what is known already is then kept.
+    void insert(const QString &folder, const QString &key, Wallet::EntryType type, const QByteArray *value);
+
+    void remove(const QString &folder, const QString &key);
+    void removeFolder(const QString &folder);
+    void clear();
+
+    // Changes whenever something is dropped, so a reply to a call made
+    // before isn't inserted.
+    quint64 generation() const
+    {
+        return _generation;
+    }
+
+    quint64 hits() const
+    {
+        return _hits;
+    }
+    quint64 misses() const
+    {
+        return _misses;
+    }
+
+private:
+    Q_DISABLE_COPY(WalletCache)
+    class Item;
+    typedef QPair<QString, QString> Key; // folder, key
+
+    // Null if there is none or it expired.
+    Item *find(const QString &folder, const QString &key);
+    bool count(bool hit);
+
+    QCache<Key, Item> _items; // the cost is the memory used
+    int _maxAge = 0;
+    quint64 _hits = 0;
+    quint64 _misses = 0;
+    quint64 _generation = 0;
+};
+
+}
+
+#endif
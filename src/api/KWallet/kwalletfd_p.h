@@ -0,0 +1,111 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETFD_P_H
+#define _KWALLETFD_P_H
+
+#include <QByteArray>
+#include <QDBusUnixFileDescriptor>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#endif
+
+// Shared by KWallet::Wallet and kwalletd, which pass the values of at least
+// FdThreshold bytes in a memfd rather than in the D-Bus message, see
+// readEntryFd and writeEntryFd in org.kde.KWallet.xml.
+namespace KWallet
+{
+enum {
+    FdThreshold = 64 * 1024,
+    FdMaxSize = 256 * 1024 * 1024, // largest value taken from a descriptor
+};
+
+// A sealed memfd holding @p value, or an invalid descriptor if there are
+// no memfds here.
+inline QDBusUnixFileDescriptor valueToFd(const QByteArray &value)
+{
+    QDBusUnixFileDescriptor result;
+#if defined(Q_OS_LINUX) && defined(MFD_CLOEXEC)
+    const int fd = memfd_create("kwallet-entry", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return result;
+    }
+
+    const char *data = value.constData();
+    qint64 left = value.size();
+    while (left > 0) {
+        const ssize_t n = ::write(fd, data, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        data += n;
+        left -= n;
+    }
+
+    if (left == 0) {
+#ifdef F_ADD_SEALS
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+        // duplicates it
+        result.setFileDescriptor(fd);
+    }
+    ::close(fd);
+#else
+    Q_UNUSED(value);
+#endif
+    return result;
+}
+
+// Reads the whole regular file or memfd @p fd into @p value. The offset of
+// the descriptor, which is shared with the sender, is not used.
+inline bool valueFromFd(const QDBusUnixFileDescriptor &fd, QByteArray &value)
+{
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (!fd.isValid() || fstat(fd.fileDescriptor(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size > FdMaxSize) {
+        return false;
+    }
+
+    const qint64 size = st.st_size;
+    QByteArray data(int(size), Qt::Uninitialized);
+    qint64 done = 0;
+    while (done < size) {
+        const ssize_t n = pread(fd.fileDescriptor(), data.data() + done, size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+
+    if (done != size) {
+        data.fill(0);
+        return false;
+    }
+    value = data;
+    return true;
+#else
+    Q_UNUSED(fd);
+    Q_UNUSED(value);
+    return false;
+#endif
+}
+
+}
+
+#endif
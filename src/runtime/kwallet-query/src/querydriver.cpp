@@ -9,6 +9,7 @@
 
 #include <iostream>
 
+#include <QDataStream>
 #include <QDebug>
 #include <QJsonDocument>
 #include <QJsonObject>
@@ -118,11 +119,17 @@ void QueryDriver::readValue()
         std::cout << i18n("The folder %1 does not exist!", entryFolder).toUtf8().constData() << std::endl;
         exit(4);
     }
-    Wallet::EntryType kind = theWallet->entryType(entryName);
+    // the type and value in a single call
+    Wallet::EntryType kind = Wallet::Unknown;
+    QByteArray value;
+    if (theWallet->readEntryTyped(entryName, kind, value) != 0) {
+        std::cout << i18n("Failed to read entry %1 value from the %2 wallet", entryName, walletName).toUtf8().constData() << std::endl;
+        exit(4);
+    }
     if (kind == Wallet::Password) {
-        readPasswordValue();
+        readPasswordValue(value);
     } else if (kind == Wallet::Map) {
-        readMapValue();
+        readMapValue(value);
     } else {
         std::cout << i18n("Failed to read entry %1 value from the %2 wallet.", entryName, walletName).toUtf8().constData() << std::endl;
         exit(4);
@@ -130,14 +137,11 @@ void QueryDriver::readValue()
     quit();
 }
 
-void QueryDriver::readMapValue()
+void QueryDriver::readMapValue(const QByteArray &value)
 {
     QMap<QString, QString> map;
-    int rc = theWallet->readMap(entryName, map);
-    if (rc != 0) {
-        std::cout << i18n("Failed to read entry %1 value from the %2 wallet", entryName, walletName).toUtf8().constData() << std::endl;
-        exit(4);
-    }
+    QDataStream ds(value);
+    ds >> map;
     QJsonObject json;
     for (auto &e : map.keys()) {
         json.insert(e, QJsonValue::fromVariant(QVariant(map.value(e))));
@@ -145,14 +149,11 @@ void QueryDriver::readMapValue()
     std::cout << QJsonDocument(json).toJson().constData() << std::endl;
 }
 
-void QueryDriver::readPasswordValue()
+void QueryDriver::readPasswordValue(const QByteArray &value)
 {
     QString entryValue;
-    int rc = theWallet->readPassword(entryName, entryValue);
-    if (rc != 0) {
-        std::cout << i18n("Failed to read entry %1 value from the %2 wallet", entryName, walletName).toUtf8().constData() << std::endl;
-        exit(4);
-    }
+    QDataStream ds(value);
+    ds >> entryValue;
     const QStringList el = entryValue.split(QStringLiteral("\n"), Qt::SkipEmptyParts);
     for (auto &e : el) {
         std::cout << e.toUtf8().constData() << std::endl;
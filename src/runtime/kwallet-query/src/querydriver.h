@@ -40,8 +40,8 @@ private:
     void timerEvent(QTimerEvent *event) override;
     void readEntries();
     void readValue();
-    void readMapValue();
-    void readPasswordValue();
+    void readMapValue(const QByteArray &value);
+    void readPasswordValue(const QByteArray &value);
     void writeValue();
 
 private Q_SLOTS:
@@ -10,11 +10,12 @@
 
 #include <KLocalizedString>
 #include <KMessageBox>
-#include <QCryptographicHash>
+#include <QBuffer>
 #include <QFile>
 #include <QIODevice>
 #include <QSaveFile>
 #include <assert.h>
+#include <gcrypt.h>
 #ifdef HAVE_GPGMEPP
 #include <gpgme++/context.h>
 #include <gpgme++/data.h>
@@ -39,6 +40,7 @@
 #define KWALLET_CIPHER_3DES_CBC 1 // unsupported
 #define KWALLET_CIPHER_GPG 2
 #define KWALLET_CIPHER_BLOWFISH_CBC 3
+#define KWALLET_CIPHER_AES256_GCM 4
 
 #define KWALLET_HASH_SHA1 0
 #define KWALLET_HASH_MD5 1 // unsupported
@@ -48,6 +50,15 @@ namespace KWallet
 {
 typedef char Digest[16];
 
+// Writes the digests of a folder and of its keys to the digest table.
+static void writeDigests(QDataStream &stream, const EntryIndex &entries, const QString &folder)
+{
+    const QVector<MD5Digest> keys = entries.keyDigests(folder);
+    stream.writeRawData(entries.folderDigest(folder).constData(), 16);
+    stream << static_cast<quint32>(keys.count());
+    stream.writeRawData(reinterpret_cast<const char *>(keys.constData()), keys.count() * 16);
+}
+
 static int getRandomBlock(QByteArray &randBlock)
 {
 #ifdef Q_OS_WIN // krazy:exclude=cpp
@@ -136,7 +147,7 @@ BackendPersistHandler *BackendPersistHandler::getPersistHandler(BackendCipherTyp
 {
     switch (cipherType) {
     case BACKEND_CIPHER_BLOWFISH:
-        return new BlowfishPersistHandler;
+        return new AesGcmPersistHandler;
 #ifdef HAVE_GPGMEPP
     case BACKEND_CIPHER_GPG:
         return new GpgPersistHandler;
@@ -149,14 +160,18 @@ BackendPersistHandler *BackendPersistHandler::getPersistHandler(BackendCipherTyp
 
 BackendPersistHandler *BackendPersistHandler::getPersistHandler(char magicBuf[12])
 {
+    // blowfish wallets are never segmented
     if ((magicBuf[2] == KWALLET_CIPHER_BLOWFISH_ECB || magicBuf[2] == KWALLET_CIPHER_BLOWFISH_CBC)
-        && (magicBuf[3] == KWALLET_HASH_SHA1 || magicBuf[3] == KWALLET_HASH_PBKDF2_SHA512)) {
+        && (magicBuf[3] == KWALLET_HASH_SHA1 || magicBuf[3] == KWALLET_HASH_PBKDF2_SHA512) && magicBuf[1] != KWALLET_VERSION_SEGMENTED) {
         bool useECBforReading = magicBuf[2] == KWALLET_CIPHER_BLOWFISH_ECB;
         if (useECBforReading) {
             qCDebug(KWALLETBACKEND_LOG) << "this wallet uses ECB encryption. It'll be converted to CBC on next save.";
         }
         return new BlowfishPersistHandler(useECBforReading);
     }
+    if (magicBuf[2] == KWALLET_CIPHER_AES256_GCM && magicBuf[3] == KWALLET_HASH_PBKDF2_SHA512) {
+        return new AesGcmPersistHandler(magicBuf[1]);
+    }
 #ifdef HAVE_GPGMEPP
     if (magicBuf[2] == KWALLET_CIPHER_GPG && magicBuf[3] == 0) {
         return new GpgPersistHandler;
@@ -165,203 +180,172 @@ BackendPersistHandler *BackendPersistHandler::getPersistHandler(char magicBuf[12
     return nullptr; // unknown cipher or hash
 }
 
-int BlowfishPersistHandler::write(Backend *wb, QSaveFile &sf, QByteArray &version, WId)
+// Size of the chunks BlowfishSealer encrypts at once; a multiple of the
+// block size
+#define KWALLET_SEAL_CHUNK_SIZE (64 * 1024)
+
+// Encrypts data the way the contents of Blowfish wallets are stored: one
+// block of random data, the size of the data, the data itself, random padding
+// and the SHA1 hash of the data, in CBC mode.
+//
+// The data is hashed and encrypted as it is written, a chunk at a time, and
+// the result goes straight to the output device, so the size of the data has
+// to be known beforehand. The key schedule of @p cipher must be set up.
+class BlowfishSealer : public QIODevice
 {
-    assert(wb->_cipherType == BACKEND_CIPHER_BLOWFISH);
-
-    if (_useECBforReading) {
-        qCDebug(KWALLETBACKEND_LOG) << "This wallet used ECB and is now saved using CBC";
-        _useECBforReading = false;
+public:
+    BlowfishSealer(QIODevice *out, BlowFish *cipher)
+        : _out(out)
+        , _bf(cipher)
+        , _remaining(0)
+        , _error(0)
+    {
+        open(QIODevice::WriteOnly | QIODevice::Unbuffered);
     }
 
-    version[2] = KWALLET_CIPHER_BLOWFISH_CBC;
-    if (!wb->_useNewHash) {
-        version[3] = KWALLET_HASH_SHA1;
-    } else {
-        version[3] = KWALLET_HASH_PBKDF2_SHA512; // Since 4.13 we always use PBKDF2_SHA512
+    ~BlowfishSealer() override
+    {
+        _chunk.fill(0);
+        _padding.fill(0);
+        _sha.reset();
     }
 
-    if (sf.write(version) != 4) {
-        sf.cancelWriting();
-        return -4; // write error
-    }
-
-    // Holds the hashes we write out
-    QByteArray hashes;
-    QDataStream hashStream(&hashes, QIODevice::WriteOnly);
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    hashStream << static_cast<quint32>(wb->_entries.count());
-
-    // Holds decrypted data prior to encryption
-    QByteArray decrypted;
-
-    // FIXME: we should estimate the amount of data we will write in each
-    // buffer and resize them approximately in order to avoid extra
-    // resizes.
-
-    // populate decrypted
-    QDataStream dStream(&decrypted, QIODevice::WriteOnly);
-    for (Backend::FolderMap::ConstIterator i = wb->_entries.constBegin(); i != wb->_entries.constEnd(); ++i) {
-        dStream << i.key();
-        dStream << static_cast<quint32>(i.value().count());
-
-        md5.reset();
-        md5.addData(i.key().toUtf8());
-        hashStream.writeRawData(md5.result().constData(), 16);
-        hashStream << static_cast<quint32>(i.value().count());
-
-        for (Backend::EntryMap::ConstIterator j = i.value().constBegin(); j != i.value().constEnd(); ++j) {
-            dStream << j.key();
-            dStream << static_cast<qint32>(j.value()->type());
-            dStream << j.value()->value();
-
-            md5.reset();
-            md5.addData(j.key().toUtf8());
-            hashStream.writeRawData(md5.result().constData(), 16);
+    int start(quint32 size)
+    {
+        const int blksz = _bf.blockSize();
+        const qint64 newsize = size + blksz + // encrypted block
+            4 + // file size
+            20; // size of the SHA hash
+        const int delta = blksz - (newsize % blksz);
+        _remaining = size;
+
+        // the padding comes from the same random block as the first one
+        QByteArray randBlock;
+        randBlock.resize(blksz + delta);
+        if (getRandomBlock(randBlock) < 0) {
+            return _error = -3; // Fatal error: can't get random
         }
-    }
 
-    if (sf.write(hashes) != hashes.size()) {
-        sf.cancelWriting();
-        return -4; // write error
-    }
-
-    // calculate the hash of the file
-    SHA1 sha;
-    BlowFish _bf;
-    CipherBlockChain bf(&_bf);
-
-    sha.process(decrypted.data(), decrypted.size());
-
-    // prepend and append the random data
-    QByteArray wholeFile;
-    long blksz = bf.blockSize();
-    long newsize = decrypted.size() + blksz + // encrypted block
-        4 + // file size
-        20; // size of the SHA hash
-
-    int delta = (blksz - (newsize % blksz));
-    newsize += delta;
-    wholeFile.resize(newsize);
-
-    QByteArray randBlock;
-    randBlock.resize(blksz + delta);
-    if (getRandomBlock(randBlock) < 0) {
-        sha.reset();
-        decrypted.fill(0);
-        sf.cancelWriting();
-        return -3; // Fatal error: can't get random
-    }
-
-    for (int i = 0; i < blksz; i++) {
-        wholeFile[i] = randBlock[i];
+        _chunk.reserve(KWALLET_SEAL_CHUNK_SIZE);
+        _chunk.append(randBlock.constData(), blksz);
+        for (int i = 0; i < 4; i++) {
+            _chunk.append(char((size >> 8 * (3 - i)) & 0xff));
+        }
+        _padding = randBlock.mid(blksz);
+        randBlock.fill(0);
+        return 0;
     }
 
-    for (int i = 0; i < 4; i++) {
-        wholeFile[(int)(i + blksz)] = (decrypted.size() >> 8 * (3 - i)) & 0xff;
-    }
+    // Pads, appends the hash and encrypts what's left.
+    int finish()
+    {
+        if (_error == 0 && _remaining != 0) {
+            _error = -2; // less data than announced
+        }
+        if (_error < 0) {
+            return _error;
+        }
 
-    for (int i = 0; i < decrypted.size(); i++) {
-        wholeFile[(int)(i + blksz + 4)] = decrypted[i];
+        _chunk.append(_padding);
+        _chunk.append(reinterpret_cast<const char *>(_sha.hash()), 20);
+        return flush();
     }
 
-    for (int i = 0; i < delta; i++) {
-        wholeFile[(int)(i + blksz + 4 + decrypted.size())] = randBlock[(int)(i + blksz)];
+    int error() const
+    {
+        return _error;
     }
 
-    const char *hash = (const char *)sha.hash();
-    for (int i = 0; i < 20; i++) {
-        wholeFile[(int)(newsize - 20 + i)] = hash[i];
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
     }
 
-    sha.reset();
-    decrypted.fill(0);
-
-    // encrypt the data
-    if (!bf.setKey(wb->_passhash.data(), wb->_passhash.size() * 8)) {
-        wholeFile.fill(0);
-        sf.cancelWriting();
-        return -2; // encrypt error
-    }
+    qint64 writeData(const char *data, qint64 len) override
+    {
+        if (_error < 0 || len > _remaining) {
+            if (_error == 0) {
+                _error = -2; // more data than announced
+            }
+            return -1;
+        }
 
-    int rc = bf.encrypt(wholeFile.data(), wholeFile.size());
-    if (rc < 0) {
-        wholeFile.fill(0);
-        sf.cancelWriting();
-        return -2; // encrypt error
+        _sha.process(data, len);
+        _remaining -= len;
+        for (qint64 done = 0; done < len;) {
+            const qint64 n = qMin<qint64>(len - done, KWALLET_SEAL_CHUNK_SIZE - _chunk.size());
+            _chunk.append(data + done, n);
+            done += n;
+            if (_chunk.size() == KWALLET_SEAL_CHUNK_SIZE && flush() < 0) {
+                return -1;
+            }
+        }
+        return len;
     }
 
-    // write the file
-    auto written = sf.write(wholeFile);
-    if (written != wholeFile.size()) {
-        wholeFile.fill(0);
-        sf.cancelWriting();
-        return -4; // write error
-    }
-    if (!sf.commit()) {
-        qCDebug(KWALLETBACKEND_LOG) << "WARNING: wallet sync to disk failed! QSaveFile status was " << sf.errorString();
-        wholeFile.fill(0);
-        return -4; // write error
+private:
+    // Encrypts and writes the chunk, which is always made of whole blocks
+    // when it's full or complete.
+    int flush()
+    {
+        const int n = _chunk.size();
+        if (_bf.encryptMore(_chunk.data(), n) < 0) {
+            _chunk.fill(0);
+            return _error = -2; // encrypt error
+        }
+        if (_out->write(_chunk.constData(), n) != n) {
+            _chunk.fill(0);
+            return _error = -4; // write error
+        }
+        _chunk.fill(0);
+        _chunk.resize(0);
+        return 0;
     }
 
-    wholeFile.fill(0);
-
-    return 0;
+    QIODevice *_out;
+    CipherBlockChain _bf;
+    SHA1 _sha;
+    QByteArray _chunk;
+    QByteArray _padding;
+    qint64 _remaining;
+    int _error;
+};
+
+// Number of bytes QDataStream uses for these
+static qint64 streamedSize(const QString &s)
+{
+    return 4 + (s.isNull() ? 0 : 2 * qint64(s.size()));
 }
 
-int BlowfishPersistHandler::read(Backend *wb, QFile &db, WId)
+static qint64 streamedSize(const QByteArray &a)
 {
-    wb->_cipherType = BACKEND_CIPHER_BLOWFISH;
-    wb->_hashes.clear();
-    // Read in the hashes
-    QDataStream hds(&db);
-    quint32 n;
-    hds >> n;
-    if (n > 0xffff) { // sanity check
-        return -43;
-    }
+    return 4 + (a.isNull() ? 0 : qint64(a.size()));
+}
 
-    for (size_t i = 0; i < n; ++i) {
-        Digest d, d2; // judgment day
-        MD5Digest ba;
-        QMap<MD5Digest, QList<MD5Digest>>::iterator it;
-        quint32 fsz;
-        if (hds.atEnd()) {
-            return -43;
-        }
-        hds.readRawData(d, 16);
-        hds >> fsz;
-        ba = MD5Digest(reinterpret_cast<char *>(d));
-        it = wb->_hashes.insert(ba, QList<MD5Digest>());
-        for (size_t j = 0; j < fsz; ++j) {
-            hds.readRawData(d2, 16);
-            ba = MD5Digest(d2);
-            (*it).append(ba);
-        }
+// Reverses what BlowfishSealer writes: decrypts @p encrypted in place,
+// checks its hash and leaves only the data in it.
+static int blowfishOpen(BlowFish *cipher, bool useECB, QByteArray &encrypted)
+{
+    if (!cipher) {
+        encrypted.fill(0);
+        return -6; // decrypt error
     }
-
-    // Read in the rest of the file.
-    QByteArray encrypted = db.readAll();
-    assert(encrypted.size() < db.size());
-
-    BlowFish _bf;
-    CipherBlockChain bf(&_bf, _useECBforReading);
+    CipherBlockChain bf(cipher, useECB);
     int blksz = bf.blockSize();
     if ((encrypted.size() % blksz) != 0) {
         return -5; // invalid file structure
     }
 
-    bf.setKey((void *)wb->_passhash.data(), wb->_passhash.size() * 8);
-
     if (!encrypted.data()) {
-        wb->_passhash.fill(0);
         encrypted.fill(0);
         return -7; // file structure error
     }
 
     int rc = bf.decrypt(encrypted.data(), encrypted.size());
     if (rc < 0) {
-        wb->_passhash.fill(0);
         encrypted.fill(0);
         return -6; // decrypt error
     }
@@ -408,11 +392,132 @@ int BlowfishPersistHandler::read(Backend *wb, QFile &db, WId)
 
     // chop off the leading blksz+4 bytes
     QByteArray tmpenc(encrypted.data() + blksz + 4, fsize);
+    encrypted.fill(0);
     encrypted = tmpenc;
-    tmpenc.fill(0);
 
-    // Load the data structures up
-    QDataStream eStream(encrypted);
+    return 0;
+}
+
+int BlowfishPersistHandler::write(Backend *wb, QSaveFile &sf, QByteArray &version, WId)
+{
+    assert(wb->_cipherType == BACKEND_CIPHER_BLOWFISH);
+
+    if (_useECBforReading) {
+        qCDebug(KWALLETBACKEND_LOG) << "This wallet used ECB and is now saved using CBC";
+        _useECBforReading = false;
+    }
+
+    version[2] = KWALLET_CIPHER_BLOWFISH_CBC;
+    if (!wb->_useNewHash) {
+        version[3] = KWALLET_HASH_SHA1;
+    } else {
+        version[3] = KWALLET_HASH_PBKDF2_SHA512; // Since 4.13 we always use PBKDF2_SHA512
+    }
+
+    if (sf.write(version) != 4) {
+        sf.cancelWriting();
+        return -4; // write error
+    }
+
+    // Holds the hashes we write out
+    QByteArray hashes;
+    QDataStream hashStream(&hashes, QIODevice::WriteOnly);
+    hashStream << static_cast<quint32>(wb->_entries.folderCount());
+
+    // The hashes and the size of the data come first, the data is then
+    // encrypted as it is serialized
+    const QStringList folders = wb->_entries.folderList();
+    QVector<QVector<EntryIndex::Item>> contents;
+    contents.reserve(folders.count());
+    qint64 size = 0;
+    for (const QString &folder : folders) {
+        contents.append(wb->_entries.items(folder));
+        const QVector<EntryIndex::Item> &items = contents.last();
+        size += streamedSize(folder) + 4;
+        writeDigests(hashStream, wb->_entries, folder);
+
+        for (const EntryIndex::Item &j : items) {
+            size += streamedSize(j.first) + 4 + streamedSize(j.second->value());
+        }
+    }
+
+    if (size > 0x7fffffff - 64) {
+        sf.cancelWriting();
+        return -2; // the size doesn't fit
+    }
+
+    if (sf.write(hashes) != hashes.size()) {
+        sf.cancelWriting();
+        return -4; // write error
+    }
+
+    BlowFish *cipher = wb->blowfish();
+    if (!cipher) {
+        sf.cancelWriting();
+        return -2; // encrypt error
+    }
+
+    BlowfishSealer sealer(&sf, cipher);
+    int rc = sealer.start(size);
+    if (rc < 0) {
+        sf.cancelWriting();
+        return rc;
+    }
+
+    QDataStream dStream(&sealer);
+    for (int i = 0; i < folders.count(); ++i) {
+        dStream << folders.at(i);
+        dStream << static_cast<quint32>(contents.at(i).count());
+
+        for (const EntryIndex::Item &j : contents.at(i)) {
+            dStream << j.first;
+            dStream << static_cast<qint32>(j.second->type());
+            dStream << j.second->value();
+        }
+    }
+
+    rc = sealer.finish();
+    if (rc < 0) {
+        sf.cancelWriting();
+        return rc;
+    }
+
+    if (!sf.commit()) {
+        qCDebug(KWALLETBACKEND_LOG) << "WARNING: wallet sync to disk failed! QSaveFile status was " << sf.errorString();
+        return -4; // write error
+    }
+
+    return 0;
+}
+
+int BlowfishPersistHandler::read(Backend *wb, QFile &db, WId)
+{
+    wb->_cipherType = BACKEND_CIPHER_BLOWFISH;
+    int rc = readDigests(wb, db);
+    if (rc < 0) {
+        return rc;
+    }
+
+    // Read in the rest of the file.
+    QByteArray encrypted = db.readAll();
+    assert(encrypted.size() < db.size());
+
+    rc = blowfishOpen(wb->blowfish(), _useECBforReading, encrypted);
+    if (rc == -6 || rc == -7) {
+        wb->_passhash.fill(0);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    // Load the data structures up. Values can stay in the decrypted data
+    // until they are needed.
+    QExplicitlySharedDataPointer<EntryPayload> payload;
+    if (wb->_lazyLoading) {
+        payload = new EntryPayload;
+        payload->data.swap(encrypted);
+    }
+    QDataStream eStream(payload ? payload->data : encrypted);
 
     while (!eStream.atEnd()) {
         QString folder;
@@ -422,38 +527,426 @@ int BlowfishPersistHandler::read(Backend *wb, QFile &db, WId)
         eStream >> n;
 
         // Force initialisation
-        wb->_entries[folder].clear();
+        wb->_entries.insertFolder(folder);
 
-        for (size_t i = 0; i < n; ++i) {
-            QString key;
-            KWallet::Wallet::EntryType et = KWallet::Wallet::Unknown;
-            Entry *e = new Entry;
-            eStream >> key;
-            qint32 x = 0; // necessary to read properly
-            eStream >> x;
-            et = static_cast<KWallet::Wallet::EntryType>(x);
+        readEntries(wb, eStream, folder, n, payload.data());
+    }
 
-            switch (et) {
-            case KWallet::Wallet::Password:
-            case KWallet::Wallet::Stream:
-            case KWallet::Wallet::Map:
-                break;
-            default: // Unknown entry
-                delete e;
-                continue;
-            }
+    wb->_open = true;
+    encrypted.fill(0);
+    return 0;
+}
+
+char BlowfishPersistHandler::cipher() const
+{
+    return KWALLET_CIPHER_BLOWFISH_CBC;
+}
+
+#define KWALLET_GCM_NONCE_SIZE 12
+#define KWALLET_GCM_TAG_SIZE 16
+
+// Sets up AES-256-GCM with a key derived from the password hash, which is
+// longer than the key and already went through PBKDF2. The key schedule is
+// kept in secure memory unless the pool is exhausted.
+static int aesGcmInit(gcry_cipher_hd_t *hd, const QByteArray &passhash, const char *nonce)
+{
+    static const char label[] = "KWallet AES-256-GCM";
+    gcry_md_hd_t md;
+    if (gcry_md_open(&md, GCRY_MD_SHA256, GCRY_MD_FLAG_SECURE) != 0 && gcry_md_open(&md, GCRY_MD_SHA256, 0) != 0) {
+        return -1;
+    }
+    gcry_md_write(md, label, sizeof(label) - 1);
+    gcry_md_write(md, passhash.constData(), passhash.size());
+
+    int rc = -1;
+    if (gcry_cipher_open(hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, GCRY_CIPHER_SECURE) == 0
+        || gcry_cipher_open(hd, GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_GCM, 0) == 0) {
+        if (gcry_cipher_setkey(*hd, gcry_md_read(md, GCRY_MD_SHA256), 32) == 0
+            && gcry_cipher_setiv(*hd, nonce, KWALLET_GCM_NONCE_SIZE) == 0) {
+            rc = 0;
+        } else {
+            gcry_cipher_close(*hd);
+        }
+    }
+    gcry_md_close(md); // wipes the key
+    return rc;
+}
+
+int AesGcmPersistHandler::write(Backend *wb, QSaveFile &sf, QByteArray &version, WId w)
+{
+    assert(wb->_cipherType == BACKEND_CIPHER_BLOWFISH);
+
+    // the layouts of the old password hash are only known to blowfish
+    if (!wb->_useNewHash || version[1] != KWALLET_VERSION_SEGMENTED) {
+        return BlowfishPersistHandler().write(wb, sf, version, w);
+    }
+
+    version[2] = KWALLET_CIPHER_AES256_GCM;
+    version[3] = KWALLET_HASH_PBKDF2_SHA512;
+    if (sf.write(version) != 4) {
+        sf.cancelWriting();
+        return -4; // write error
+    }
+    return writeSegments(wb, sf);
+}
+
+int AesGcmPersistHandler::read(Backend *wb, QFile &db, WId)
+{
+    wb->_cipherType = BACKEND_CIPHER_BLOWFISH;
+    if (_revision != KWALLET_VERSION_SEGMENTED) {
+        return -43;
+    }
+
+    int rc = readDigests(wb, db);
+    if (rc < 0) {
+        return rc;
+    }
+    return readSegments(wb, db);
+}
+
+char AesGcmPersistHandler::cipher() const
+{
+    return KWALLET_CIPHER_AES256_GCM;
+}
+
+// The nonce, the data and the authentication tag
+int AesGcmPersistHandler::sealBlock(Backend *wb, const QByteArray &payload, QByteArray &sealed)
+{
+    if (!gcry_check_version("1.6.0")) {
+        return -2; // no GCM support
+    }
+
+    sealed.resize(KWALLET_GCM_NONCE_SIZE + payload.size() + KWALLET_GCM_TAG_SIZE);
+    char *nonce = sealed.data();
+    char *data = nonce + KWALLET_GCM_NONCE_SIZE;
+    gcry_create_nonce(nonce, KWALLET_GCM_NONCE_SIZE);
 
+    gcry_cipher_hd_t hd;
+    if (aesGcmInit(&hd, wb->_passhash, nonce) < 0) {
+        sealed.clear();
+        return -2; // encrypt error
+    }
+    int rc = 0;
+    if (gcry_cipher_encrypt(hd, data, payload.size(), payload.constData(), payload.size()) != 0
+        || gcry_cipher_gettag(hd, data + payload.size(), KWALLET_GCM_TAG_SIZE) != 0) {
+        sealed.fill(0);
+        sealed.clear();
+        rc = -2; // encrypt error
+    }
+    gcry_cipher_close(hd);
+    return rc;
+}
+
+int AesGcmPersistHandler::openBlock(Backend *wb, const QByteArray &sealed, QByteArray &payload)
+{
+    if (sealed.size() < KWALLET_GCM_NONCE_SIZE + KWALLET_GCM_TAG_SIZE) {
+        return -5; // invalid file structure
+    }
+    if (!gcry_check_version("1.6.0")) {
+        return -6; // no GCM support
+    }
+
+    const char *nonce = sealed.constData();
+    const char *data = nonce + KWALLET_GCM_NONCE_SIZE;
+    const int size = sealed.size() - KWALLET_GCM_NONCE_SIZE - KWALLET_GCM_TAG_SIZE;
+
+    gcry_cipher_hd_t hd;
+    if (aesGcmInit(&hd, wb->_passhash, nonce) < 0) {
+        return -6; // decrypt error
+    }
+    payload.resize(size);
+    int rc = 0;
+    if (gcry_cipher_decrypt(hd, payload.data(), size, data, size) != 0) {
+        rc = -6; // decrypt error
+    } else if (gcry_cipher_checktag(hd, data + size, KWALLET_GCM_TAG_SIZE) != 0) {
+        rc = -9; // wrong password or corrupted data
+    }
+    gcry_cipher_close(hd);
+    if (rc < 0) {
+        payload.fill(0);
+        payload.clear();
+    }
+    return rc;
+}
+
+void BackendPersistHandler::writeEntries(Backend *wb, QDataStream &stream, const QString &folder)
+{
+    const QVector<EntryIndex::Item> items = wb->_entries.items(folder);
+    stream << folder;
+    stream << static_cast<quint32>(items.count());
+    for (const EntryIndex::Item &j : items) {
+        stream << j.first;
+        stream << static_cast<qint32>(j.second->type());
+        stream << j.second->value();
+    }
+}
+
+void BackendPersistHandler::readEntries(Backend *wb, QDataStream &stream, const QString &folder, quint32 count, EntryPayload *payload)
+{
+    for (size_t i = 0; i < count; ++i) {
+        QString key;
+        KWallet::Wallet::EntryType et = KWallet::Wallet::Unknown;
+        stream >> key;
+        qint32 x = 0; // necessary to read properly
+        stream >> x;
+        et = static_cast<KWallet::Wallet::EntryType>(x);
+
+        switch (et) {
+        case KWallet::Wallet::Password:
+        case KWallet::Wallet::Stream:
+        case KWallet::Wallet::Map:
+            break;
+        default: // Unknown entry
+            continue;
+        }
+
+        Entry *e = wb->_arena.create();
+        if (payload) {
+            const qint64 offset = stream.device()->pos();
+            quint32 size;
+            stream >> size;
+            if (size != 0xffffffff) {
+                stream.skipRawData(size);
+            }
+            e->setValue(QExplicitlySharedDataPointer<EntryPayload>(payload), offset);
+        } else {
             QByteArray a;
-            eStream >> a;
+            stream >> a;
             e->setValue(a);
-            e->setType(et);
-            e->setKey(key);
-            wb->_entries[folder][key] = e;
         }
+        e->setType(et);
+        e->setKey(key);
+        wb->_arena.destroy(wb->_entries.insert(folder, key, e));
+    }
+}
+
+int BackendPersistHandler::readDigests(Backend *wb, QFile &db)
+{
+    QDataStream hds(&db);
+    return wb->_hashes.read(hds);
+}
+
+int BackendPersistHandler::readIndex(QIODevice *db, DigestTable &hashes)
+{
+    char magicBuf[KWMAGIC_LEN];
+    if (db->read(magicBuf, KWMAGIC_LEN) != KWMAGIC_LEN || memcmp(magicBuf, KWMAGIC, KWMAGIC_LEN) != 0) {
+        return -3; // bad magic
+    }
+
+    char version[4];
+    if (db->read(version, 4) != 4 || version[0] != KWALLET_VERSION_MAJOR || version[1] < 0 || version[1] > KWALLET_VERSION_SEGMENTED) {
+        return -4; // unknown version
+    }
+    if (version[2] != KWALLET_CIPHER_BLOWFISH_ECB && version[2] != KWALLET_CIPHER_BLOWFISH_CBC && version[2] != KWALLET_CIPHER_AES256_GCM) {
+        return -41; // the digests are encrypted too
+    }
+
+    QDataStream stream(db);
+    int rc = hashes.read(stream);
+    if (rc < 0) {
+        return rc;
+    }
+
+    // skip the encrypted data to get to the journal records
+    qint64 size = 0;
+    if (version[1] == KWALLET_VERSION_SEGMENTED) {
+        quint32 count = 0;
+        stream >> count;
+        if (count > 0x10000) { // sanity check
+            return -43;
+        }
+        for (quint32 i = 0; i < count; ++i) {
+            quint32 n;
+            stream >> n;
+            size += n;
+        }
+    } else {
+        return 0;
+    }
+    if (stream.status() != QDataStream::Ok || size > db->bytesAvailable() || !db->seek(db->pos() + size)) {
+        return -43;
+    }
+
+    QVector<Journal::DigestOp> ops;
+    QByteArray sealed;
+    while (Journal::readRecord(db, ops, sealed)) {
+        Journal::applyDigests(hashes, ops);
+    }
+    return 0;
+}
+
+int BackendPersistHandler::writeSegments(Backend *wb, QSaveFile &sf)
+{
+    // Holds the hashes we write out, followed by the segment table
+    QByteArray hashes;
+    QDataStream hashStream(&hashes, QIODevice::WriteOnly);
+    hashStream << static_cast<quint32>(wb->_entries.folderCount());
+
+    QByteArray directory;
+    QDataStream dirStream(&directory, QIODevice::WriteOnly);
+    dirStream << static_cast<quint32>(wb->_entries.folderCount());
+
+    QVector<QByteArray> segments;
+    segments.reserve(wb->_entries.folderCount() + 1);
+    segments.append(QByteArray()); // the directory, sealed last
+
+    const QStringList folders = wb->_entries.folderList();
+    for (const QString &folder : folders) {
+        dirStream << folder;
+
+        if (wb->_encryptedFolders.contains(folder)) {
+            // the keys aren't known, but the digests read from the file are
+            // still accurate since the folder can't have changed
+            const MD5Digest folderMd5 = wb->_entries.folderDigest(folder);
+            hashStream.writeRawData(folderMd5.constData(), 16);
+            wb->_hashes.value(folderMd5).write(hashStream);
+        } else {
+            writeDigests(hashStream, wb->_entries, folder);
+        }
+
+        // folders which didn't change since they were last sealed are
+        // written as they are
+        Backend::SegmentMap::ConstIterator s = wb->_segments.constFind(folder);
+        if (s == wb->_segments.constEnd()) {
+            QByteArray decrypted;
+            QDataStream dStream(&decrypted, QIODevice::WriteOnly);
+            writeEntries(wb, dStream, folder);
+
+            QByteArray sealed;
+            int rc = sealBlock(wb, decrypted, sealed);
+            decrypted.fill(0);
+            if (rc < 0) {
+                sf.cancelWriting();
+                return rc;
+            }
+            s = wb->_segments.insert(folder, sealed);
+        }
+        segments.append(s.value());
+    }
+
+    int rc = sealBlock(wb, directory, segments[0]);
+    if (rc < 0) {
+        sf.cancelWriting();
+        return rc;
+    }
+
+    hashStream << static_cast<quint32>(segments.count());
+    for (const QByteArray &segment : qAsConst(segments)) {
+        hashStream << static_cast<quint32>(segment.size());
+    }
+
+    if (sf.write(hashes) != hashes.size()) {
+        sf.cancelWriting();
+        return -4; // write error
+    }
+
+    for (const QByteArray &segment : qAsConst(segments)) {
+        if (sf.write(segment) != segment.size()) {
+            sf.cancelWriting();
+            return -4; // write error
+        }
+    }
+
+    if (!sf.commit()) {
+        qCDebug(KWALLETBACKEND_LOG) << "WARNING: wallet sync to disk failed! QSaveFile status was " << sf.errorString();
+        return -4; // write error
+    }
+
+    return 0;
+}
+
+int BackendPersistHandler::readSegments(Backend *wb, QFile &db)
+{
+    QDataStream stream(&db);
+    quint32 count = 0;
+    stream >> count;
+    if (stream.status() != QDataStream::Ok || count == 0 || count > 0x10000) { // sanity check
+        return -43;
+    }
+
+    QVector<quint32> sizes(count);
+    qint64 total = 0;
+    for (quint32 &size : sizes) {
+        stream >> size;
+        total += size;
+    }
+    if (stream.status() != QDataStream::Ok || total > db.bytesAvailable()) {
+        return -43;
     }
 
+    QVector<QByteArray> segments;
+    segments.reserve(count);
+    for (quint32 size : qAsConst(sizes)) {
+        segments.append(db.read(size));
+    }
+    // the journal records follow
+    wb->_journal.setBase(db.pos());
+
+    QByteArray directory;
+    int rc = openBlock(wb, segments.at(0), directory);
+    if (rc == -6 || rc == -7) {
+        wb->_passhash.fill(0);
+    }
+    if (rc < 0) {
+        return rc;
+    }
+
+    QDataStream dirStream(directory);
+    QStringList folders;
+    quint32 n = 0;
+    dirStream >> n;
+    for (quint32 i = 0; i < n && dirStream.status() == QDataStream::Ok; ++i) {
+        QString folder;
+        dirStream >> folder;
+        folders.append(folder);
+    }
+    directory.fill(0);
+    if (dirStream.status() != QDataStream::Ok || n != count - 1) {
+        return -43;
+    }
+
+    // Folders are only decrypted when they are used, see Backend::setFolder()
+    for (int i = 0; i < folders.count(); ++i) {
+        wb->_entries.insertFolder(folders.at(i));
+        wb->_segments.insert(folders.at(i), segments.at(i + 1));
+        wb->_encryptedFolders.insert(folders.at(i));
+    }
     wb->_open = true;
-    encrypted.fill(0);
+
+    for (const QString &folder : qAsConst(folders)) {
+        if (!wb->_lazyLoading || folder == wb->_folder) {
+            wb->decryptFolder(folder);
+        }
+    }
+    return 0;
+}
+
+int BackendPersistHandler::readFolder(Backend *wb, const QString &folder)
+{
+    QByteArray decrypted;
+    int rc = openBlock(wb, wb->_segments.value(folder), decrypted);
+    if (rc < 0) {
+        return rc;
+    }
+
+    QExplicitlySharedDataPointer<EntryPayload> payload;
+    if (wb->_lazyLoading) {
+        payload = new EntryPayload;
+        payload->data.swap(decrypted);
+    }
+    QDataStream stream(payload ? payload->data : decrypted);
+
+    QString name;
+    quint32 n = 0;
+    stream >> name >> n;
+    if (stream.status() != QDataStream::Ok || name != folder) {
+        decrypted.fill(0);
+        return -43;
+    }
+
+    readEntries(wb, stream, folder, n, payload.data());
+    decrypted.fill(0);
+    wb->_encryptedFolders.remove(folder);
     return 0;
 }
 
@@ -508,32 +1001,22 @@ int GpgPersistHandler::write(Backend *wb, QSaveFile &sf, QByteArray &version, WI
 
     QByteArray hashes;
     QDataStream hashStream(&hashes, QIODevice::WriteOnly);
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    hashStream << static_cast<quint32>(wb->_entries.count());
+    hashStream << static_cast<quint32>(wb->_entries.folderCount());
 
     QByteArray values;
     QDataStream valueStream(&values, QIODevice::WriteOnly);
-    Backend::FolderMap::ConstIterator i = wb->_entries.constBegin();
-    Backend::FolderMap::ConstIterator ie = wb->_entries.constEnd();
-    for (; i != ie; ++i) {
-        valueStream << i.key();
-        valueStream << static_cast<quint32>(i.value().count());
-
-        md5.reset();
-        md5.addData(i.key().toUtf8());
-        hashStream.writeRawData(md5.result().constData(), 16);
-        hashStream << static_cast<quint32>(i.value().count());
-
-        Backend::EntryMap::ConstIterator j = i.value().constBegin();
-        Backend::EntryMap::ConstIterator je = i.value().constEnd();
-        for (; j != je; ++j) {
-            valueStream << j.key();
-            valueStream << static_cast<qint32>(j.value()->type());
-            valueStream << j.value()->value();
-
-            md5.reset();
-            md5.addData(j.key().toUtf8());
-            hashStream.writeRawData(md5.result().constData(), 16);
+    const QStringList folders = wb->_entries.folderList();
+    for (const QString &folder : folders) {
+        const QVector<EntryIndex::Item> items = wb->_entries.items(folder);
+        valueStream << folder;
+        valueStream << static_cast<quint32>(items.count());
+
+        writeDigests(hashStream, wb->_entries, folder);
+
+        for (const EntryIndex::Item &j : items) {
+            valueStream << j.first;
+            valueStream << static_cast<qint32>(j.second->type());
+            valueStream << j.second->value();
         }
     }
 
@@ -586,6 +1069,11 @@ int GpgPersistHandler::write(Backend *wb, QSaveFile &sf, QByteArray &version, WI
     return 0;
 }
 
+char GpgPersistHandler::cipher() const
+{
+    return KWALLET_CIPHER_GPG;
+}
+
 int GpgPersistHandler::read(Backend *wb, QFile &sf, WId w)
 {
     GpgME::Error err = initGpgME();
@@ -704,13 +1192,8 @@ retry_label:
         quint32 folderSize;
         hashStream >> folderSize;
 
-        MD5Digest ba = MD5Digest(reinterpret_cast<char *>(d));
-        QMap<MD5Digest, QList<MD5Digest>>::iterator it = wb->_hashes.insert(ba, QList<MD5Digest>());
-        while (folderSize--) {
-            Digest d2;
-            hashStream.readRawData(d2, 16);
-            ba = MD5Digest(d2);
-            (*it).append(ba);
+        if (!wb->_hashes[MD5Digest(d)].read(hashStream, folderSize)) {
+            return -43;
         }
     }
 
@@ -721,11 +1204,10 @@ retry_label:
         quint32 entryCount;
         valueStream >> entryCount;
 
-        wb->_entries[folder].clear();
+        wb->_entries.insertFolder(folder);
 
         while (entryCount--) {
             KWallet::Wallet::EntryType et = KWallet::Wallet::Unknown;
-            Entry *e = new Entry;
 
             QString key;
             valueStream >> key;
@@ -740,16 +1222,16 @@ retry_label:
             case KWallet::Wallet::Map:
                 break;
             default: // Unknown entry
-                delete e;
                 continue;
             }
 
             QByteArray a;
             valueStream >> a;
+            Entry *e = wb->_arena.create();
             e->setValue(a);
             e->setType(et);
             e->setKey(key);
-            wb->_entries[folder][key] = e;
+            wb->_arena.destroy(wb->_entries.insert(folder, key, e));
         }
     }
 
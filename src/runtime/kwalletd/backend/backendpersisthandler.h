@@ -8,19 +8,31 @@
 #ifndef BACKENDPERSISTHANDLER_H
 #define BACKENDPERSISTHANDLER_H
 
+#define KWMAGIC "KWALLET\n\r\0\r\n"
 #define KWMAGIC_LEN 12
 
+#define KWALLET_VERSION_MAJOR 0
+
+// Second version byte of wallets with each folder encrypted separately in a
+// base image, followed by journal records (see Journal)
+#define KWALLET_VERSION_SEGMENTED 2
+
 #include <qwindowdefs.h>
 
+class QDataStream;
 class QFile;
+class QIODevice;
 class QSaveFile;
+class QString;
 namespace KWallet
 {
 class Backend;
+class DigestTable;
+class EntryPayload;
 
 enum BackendCipherType {
     BACKEND_CIPHER_UNKNOWN, /// this is used by freshly allocated wallets
-    BACKEND_CIPHER_BLOWFISH, /// use the legacy blowfish cipher type
+    BACKEND_CIPHER_BLOWFISH, /// password based encryption: AES-256-GCM, or blowfish for older wallets
 #ifdef HAVE_GPGMEPP
     BACKEND_CIPHER_GPG, /// use GPG backend to encrypt wallet contents
 #endif // HAVE_GPGMEPP
@@ -49,6 +61,57 @@ public:
 
     virtual int write(Backend *wb, QSaveFile &sf, QByteArray &version, WId w) = 0;
     virtual int read(Backend *wb, QFile &sf, WId w) = 0;
+
+    // The cipher byte of the version written by this handler
+    virtual char cipher() const = 0;
+
+    /**
+     * Handlers able to seal independent blocks of data store wallets as
+     * per-folder segments, decrypted only when the folder is used, and let
+     * Backend::sync() append journal records instead of rewriting the wallet.
+     * The others always get the whole wallet to read and write.
+     */
+    virtual bool supportsSegments() const
+    {
+        return false;
+    }
+    virtual int sealBlock(Backend *wb, const QByteArray &payload, QByteArray &sealed)
+    {
+        Q_UNUSED(wb);
+        Q_UNUSED(payload);
+        Q_UNUSED(sealed);
+        return -1;
+    }
+    virtual int openBlock(Backend *wb, const QByteArray &sealed, QByteArray &payload)
+    {
+        Q_UNUSED(wb);
+        Q_UNUSED(sealed);
+        Q_UNUSED(payload);
+        return -1;
+    }
+
+    // Decrypts the segment of @p folder, loading its entries.
+    int readFolder(Backend *wb, const QString &folder);
+
+    // Reads the digest table of a wallet file, including the changes made
+    // by its journal records, without decrypting anything. Fails for
+    // wallets keeping the table in their encrypted data, like GPG ones.
+    static int readIndex(QIODevice *db, DigestTable &hashes);
+
+protected:
+    // The cleartext digests of the folders and keys
+    static int readDigests(Backend *wb, QFile &db);
+
+    // Segmented layout, following the digest table: the number of segments,
+    // their sizes and the segments themselves. The first one lists the
+    // folders, the others hold one folder each.
+    int writeSegments(Backend *wb, QSaveFile &sf);
+    int readSegments(Backend *wb, QFile &db);
+
+    // Entries of a folder, as stored in the encrypted data. When reading
+    // with a @p payload, values are left in it until they are needed.
+    static void writeEntries(Backend *wb, QDataStream &stream, const QString &folder);
+    static void readEntries(Backend *wb, QDataStream &stream, const QString &folder, quint32 count, EntryPayload *payload);
 };
 
 class BlowfishPersistHandler : public BackendPersistHandler
@@ -64,11 +127,44 @@ public:
 
     int write(Backend *wb, QSaveFile &sf, QByteArray &version, WId w) override;
     int read(Backend *wb, QFile &sf, WId w) override;
+    char cipher() const override;
 
 private:
     bool _useECBforReading;
 };
 
+/**
+ * Password based wallets written since the segmented layout. Each segment and
+ * journal record is sealed with AES-256 in GCM mode under a fresh nonce; the
+ * authentication tag takes the place of the SHA1 hash of the blowfish format.
+ * Wallets still using the old password hash are written with blowfish.
+ */
+class AesGcmPersistHandler : public BackendPersistHandler
+{
+public:
+    explicit AesGcmPersistHandler(int revision = KWALLET_VERSION_SEGMENTED)
+        : _revision(revision)
+    {
+    }
+    ~AesGcmPersistHandler() override
+    {
+    }
+
+    int write(Backend *wb, QSaveFile &sf, QByteArray &version, WId w) override;
+    int read(Backend *wb, QFile &sf, WId w) override;
+    char cipher() const override;
+
+    bool supportsSegments() const override
+    {
+        return true;
+    }
+    int sealBlock(Backend *wb, const QByteArray &payload, QByteArray &sealed) override;
+    int openBlock(Backend *wb, const QByteArray &sealed, QByteArray &payload) override;
+
+private:
+    int _revision;
+};
+
 #ifdef HAVE_GPGMEPP
 class GpgPersistHandler : public BackendPersistHandler
 {
@@ -82,6 +178,7 @@ public:
 
     int write(Backend *wb, QSaveFile &sf, QByteArray &version, WId w) override;
     int read(Backend *wb, QFile &sf, WId w) override;
+    char cipher() const override;
 };
 #endif // HAVE_GPGMEPP
 
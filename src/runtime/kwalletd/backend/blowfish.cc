@@ -5,31 +5,28 @@
     SPDX-License-Identifier: LGPL-2.0-or-later
 */
 
-// FIXME: should we unroll some loops?  Optimization can be done here.
-
 /* Implementation of 16 rounds blowfish as described in:
  * _Applied_Cryptography_ (c) Bruce Schneier, 1996.
  */
 
 #include "blowfish.h"
 
+#include <QtEndian>
+#include <algorithm>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "blowfishtables.h"
 
-// DO NOT INCLUDE THIS. IT BREAKS KWALLET.
-// We need to live with -Wundef until someone really figures out the problem.
-//#include <QtCore/qglobal.h> // for Q_BYTE_ORDER and friends
-// Workaround for -Wundef
-#define Q_BIG_ENDIAN 1
-#define Q_BYTE_ORDER Q_BIG_ENDIAN
+// Blocks going through the rounds together. Their S-box lookups are
+// independent, so they overlap instead of waiting on each other.
+#define KWALLET_BF_LANES 8
 
 BlowFish::BlowFish()
 {
     _blksz = 8;
-    m_key = nullptr;
+    m_keylen = 0;
     m_initialized = false;
 }
 
@@ -52,7 +49,7 @@ bool BlowFish::init()
     for (int i = 0; i < 18; i++) {
         data = 0;
         for (int k = 0; k < 4; ++k) {
-            data = (data << 8) | ((unsigned char *)m_key)[j++];
+            data = (data << 8) | m_key[j++];
             if (j >= m_keylen / 8) {
                 j = 0;
             }
@@ -75,14 +72,18 @@ bool BlowFish::init()
     }
 
     // Nice code from gpg's implementation...
-    //     check to see if the key is weak and return error if so
-    for (int i = 0; i < 255; i++) {
-        for (int j = i + 1; j < 256; j++) {
-            if ((m_S[0][i] == m_S[0][j]) || (m_S[1][i] == m_S[1][j]) ||
-                    (m_S[2][i] == m_S[2][j]) || (m_S[3][i] == m_S[3][j])) {
-                return false;
-            }
-        }
+    //     check to see if the key is weak and return error if so.
+    // Duplicates end up next to each other once the sbox is sorted.
+    uint32_t sorted[256];
+    bool weak = false;
+    for (int i = 0; i < 4 && !weak; i++) {
+        memcpy(sorted, m_S[i], sizeof(sorted));
+        std::sort(sorted, sorted + 256);
+        weak = std::adjacent_find(sorted, sorted + 256) != sorted + 256;
+    }
+    memset(sorted, 0, sizeof(sorted));
+    if (weak) {
+        return false;
     }
 
     m_initialized = true;
@@ -92,8 +93,9 @@ bool BlowFish::init()
 
 BlowFish::~BlowFish()
 {
-    delete[](unsigned char *)m_key;
-    m_key = nullptr;
+    memset(m_key, 0, sizeof(m_key));
+    memset(m_S, 0, sizeof(m_S));
+    memset(m_P, 0, sizeof(m_P));
 }
 
 int BlowFish::keyLen() const
@@ -117,132 +119,168 @@ bool BlowFish::setKey(void *key, int bitlength)
         return false;
     }
 
-    delete[](unsigned char *)m_key;
-
-    m_key = new unsigned char[bitlength / 8];
+    m_initialized = false;
+    memset(m_key, 0, sizeof(m_key));
     memcpy(m_key, key, bitlength / 8);
     m_keylen = bitlength;
 
     return init();
 }
-// clang-format off
-#if Q_BYTE_ORDER == Q_BIG_ENDIAN
-#define shuffle(x) do {             \
-        uint32_t r = x;             \
-        x  = (r & 0xff000000) >> 24;    \
-        x |= (r & 0x00ff0000) >>  8;    \
-        x |= (r & 0x0000ff00) <<  8;    \
-        x |= (r & 0x000000ff) << 24;    \
-    } while (0)
-#endif
-// clang-format on
 
-int BlowFish::encrypt(void *block, int len)
+bool BlowFish::hasKey(const void *key, int bitlength) const
 {
-    uint32_t *d = (uint32_t *)block;
-
-    if (!m_initialized || len % _blksz != 0) {
-        return -1;
-    }
+    return m_initialized && bitlength == m_keylen && memcmp(key, m_key, bitlength / 8) == 0;
+}
 
-    for (int i = 0; i < len / _blksz; i++) {
+// The halves of a block are native words with their bytes swapped, as they
+// always were in wallet files: big endian words on little endian hosts,
+// little endian ones on big endian hosts.
+static inline uint32_t loadWord(const unsigned char *data)
+{
 #if Q_BYTE_ORDER == Q_BIG_ENDIAN
-        shuffle(*d);
-        shuffle(*(d + 1));
+    return qFromLittleEndian<quint32>(data);
+#else
+    return qFromBigEndian<quint32>(data);
 #endif
-        encipher(d, d + 1);
+}
+
+static inline void storeWord(uint32_t word, unsigned char *data)
+{
 #if Q_BYTE_ORDER == Q_BIG_ENDIAN
-        shuffle(*d);
-        shuffle(*(d + 1));
+    qToLittleEndian<quint32>(word, data);
+#else
+    qToBigEndian<quint32>(word, data);
 #endif
-        d += 2;
+}
+
+template<int N>
+static inline void loadBlocks(const unsigned char *data, uint32_t *l, uint32_t *r)
+{
+    for (int k = 0; k < N; ++k) {
+        l[k] = loadWord(data + 8 * k);
+        r[k] = loadWord(data + 8 * k + 4);
     }
+}
 
-    return len;
+template<int N>
+static inline void storeBlocks(unsigned char *data, const uint32_t *l, const uint32_t *r)
+{
+    for (int k = 0; k < N; ++k) {
+        storeWord(l[k], data + 8 * k);
+        storeWord(r[k], data + 8 * k + 4);
+    }
 }
 
-int BlowFish::decrypt(void *block, int len)
+static inline uint32_t F(const uint32_t S[4][256], uint32_t x)
 {
-    uint32_t *d = (uint32_t *)block;
+    return ((S[0][x >> 24] + S[1][(x >> 16) & 0xff]) ^ S[2][(x >> 8) & 0xff]) + S[3][x & 0xff];
+}
 
+// Two rounds per step, so the halves don't have to be exchanged. The halves
+// are copied to locals so the compiler knows the tables don't change under
+// them and keeps them in registers.
+template<int N>
+static inline void encipherBlocks(const uint32_t S[4][256], const uint32_t P[18], uint32_t *xl, uint32_t *xr)
+{
+    uint32_t l[N], r[N];
+    for (int k = 0; k < N; ++k) {
+        l[k] = xl[k];
+        r[k] = xr[k];
+    }
+    for (int i = 0; i < 16; i += 2) {
+        for (int k = 0; k < N; ++k) {
+            l[k] ^= P[i];
+            r[k] ^= F(S, l[k]);
+            r[k] ^= P[i + 1];
+            l[k] ^= F(S, r[k]);
+        }
+    }
+    for (int k = 0; k < N; ++k) {
+        xl[k] = r[k] ^ P[17];
+        xr[k] = l[k] ^ P[16];
+    }
+}
+
+template<int N>
+static inline void decipherBlocks(const uint32_t S[4][256], const uint32_t P[18], uint32_t *xl, uint32_t *xr)
+{
+    uint32_t l[N], r[N];
+    for (int k = 0; k < N; ++k) {
+        l[k] = xl[k];
+        r[k] = xr[k];
+    }
+    for (int i = 17; i > 1; i -= 2) {
+        for (int k = 0; k < N; ++k) {
+            l[k] ^= P[i];
+            r[k] ^= F(S, l[k]);
+            r[k] ^= P[i - 1];
+            l[k] ^= F(S, r[k]);
+        }
+    }
+    for (int k = 0; k < N; ++k) {
+        xl[k] = r[k] ^ P[0];
+        xr[k] = l[k] ^ P[1];
+    }
+}
+
+int BlowFish::encrypt(void *block, int len)
+{
     if (!m_initialized || len % _blksz != 0) {
         return -1;
     }
 
-    for (int i = 0; i < len / _blksz; i++) {
-#if Q_BYTE_ORDER == Q_BIG_ENDIAN
-        shuffle(*d);
-        shuffle(*(d + 1));
-#endif
-        decipher(d, d + 1);
-#if Q_BYTE_ORDER == Q_BIG_ENDIAN
-        shuffle(*d);
-        shuffle(*(d + 1));
-#endif
-        d += 2;
+    unsigned char *d = static_cast<unsigned char *>(block);
+    const int blocks = len / _blksz;
+    uint32_t l[KWALLET_BF_LANES], r[KWALLET_BF_LANES];
+    int i = 0;
+    for (; i + KWALLET_BF_LANES <= blocks; i += KWALLET_BF_LANES) {
+        loadBlocks<KWALLET_BF_LANES>(d, l, r);
+        encipherBlocks<KWALLET_BF_LANES>(m_S, m_P, l, r);
+        storeBlocks<KWALLET_BF_LANES>(d, l, r);
+        d += KWALLET_BF_LANES * 8;
+    }
+    for (; i < blocks; ++i) {
+        loadBlocks<1>(d, l, r);
+        encipherBlocks<1>(m_S, m_P, l, r);
+        storeBlocks<1>(d, l, r);
+        d += 8;
     }
 
     return len;
 }
 
-uint32_t BlowFish::F(uint32_t x)
+int BlowFish::decrypt(void *block, int len)
 {
-    unsigned short a, b, c, d;
-    uint32_t y;
-
-    d = x & 0x000000ff;
-    x >>= 8;
-    c = x & 0x000000ff;
-    x >>= 8;
-    b = x & 0x000000ff;
-    x >>= 8;
-    a = x & 0x000000ff;
+    if (!m_initialized || len % _blksz != 0) {
+        return -1;
+    }
 
-    y = m_S[0][a] + m_S[1][b];
-    y ^= m_S[2][c];
-    y += m_S[3][d];
+    unsigned char *d = static_cast<unsigned char *>(block);
+    const int blocks = len / _blksz;
+    uint32_t l[KWALLET_BF_LANES], r[KWALLET_BF_LANES];
+    int i = 0;
+    for (; i + KWALLET_BF_LANES <= blocks; i += KWALLET_BF_LANES) {
+        loadBlocks<KWALLET_BF_LANES>(d, l, r);
+        decipherBlocks<KWALLET_BF_LANES>(m_S, m_P, l, r);
+        storeBlocks<KWALLET_BF_LANES>(d, l, r);
+        d += KWALLET_BF_LANES * 8;
+    }
+    for (; i < blocks; ++i) {
+        loadBlocks<1>(d, l, r);
+        decipherBlocks<1>(m_S, m_P, l, r);
+        storeBlocks<1>(d, l, r);
+        d += 8;
+    }
 
-    return y;
+    return len;
 }
 
 void BlowFish::encipher(uint32_t *xl, uint32_t *xr)
 {
-    uint32_t Xl = *xl, Xr = *xr, temp;
-
-    for (int i = 0; i < 16; ++i) {
-        Xl ^= m_P[i];
-        Xr ^= F(Xl);
-        // Exchange
-        temp = Xl; Xl = Xr; Xr = temp;
-    }
-
-    // Exchange
-    temp = Xl; Xl = Xr; Xr = temp;
-
-    Xr ^= m_P[16];
-    Xl ^= m_P[17];
-
-    *xl = Xl;
-    *xr = Xr;
+    encipherBlocks<1>(m_S, m_P, xl, xr);
 }
 
 void BlowFish::decipher(uint32_t *xl, uint32_t *xr)
 {
-    uint32_t Xl = *xl, Xr = *xr, temp;
-
-    for (int i = 17; i > 1; --i) {
-        Xl ^= m_P[i];
-        Xr ^= F(Xl);
-        // Exchange
-        temp = Xl; Xl = Xr; Xr = temp;
-    }
-
-    // Exchange
-    temp = Xl; Xl = Xr; Xr = temp;
-
-    Xr ^= m_P[1];
-    Xl ^= m_P[0];
-
-    *xl = Xl;
-    *xr = Xr;
+    decipherBlocks<1>(m_S, m_P, xl, xr);
 }
@@ -31,6 +31,9 @@ public:
 
     bool setKey(void *key, int bitlength) override;
 
+    // True if the key schedule was expanded from this key.
+    bool hasKey(const void *key, int bitlength) const;
+
     int keyLen() const override;
 
     bool variableKeyLen() const override;
@@ -45,13 +48,12 @@ private:
     uint32_t m_S[4][256];
     uint32_t m_P[18];
 
-    void *m_key;
+    unsigned char m_key[56];
     int m_keylen; // in bits
 
     bool m_initialized;
 
     bool init();
-    uint32_t F(uint32_t x);
     void encipher(uint32_t *xl, uint32_t *xr);
     void decipher(uint32_t *xl, uint32_t *xr);
 };
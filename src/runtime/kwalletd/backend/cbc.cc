@@ -7,6 +7,13 @@
 
 #include "cbc.h"
 #include "kwalletbackend_debug.h"
+
+#include <QByteArray>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <QVarLengthArray>
+#include <QVector>
 #include <string.h>
 
 CipherBlockChain::CipherBlockChain(BlockCipher *cipher, bool useECBforReading) :
@@ -74,37 +81,52 @@ void CipherBlockChain::initRegister() {
 int CipherBlockChain::encrypt(void *block, int len)
 {
     if (_cipher && !_reader) {
-        int rc;
-
-        _writer |= 1;
-
         initRegister();
+        return encryptBlocks(block, len);
+    }
+    return -1;
+}
 
-        if ((len % _len) >0) {
-            qCDebug(KWALLETBACKEND_LOG) << "Block length given encrypt (" << len << ") is not a multiple of " << _len;
-            return -1;
+int CipherBlockChain::encryptMore(void *block, int len)
+{
+    if (_cipher && !_reader) {
+        if (_register == nullptr) {
+            initRegister();
         }
+        return encryptBlocks(block, len);
+    }
+    return -1;
+}
 
-        char *elemBlock = static_cast<char*>(block);
-        for (int b = 0; b < len/_len; b++) {
+int CipherBlockChain::encryptBlocks(void *block, int len)
+{
+    int rc = 0;
 
-            // This might be optimizable
-            char *tb = static_cast<char*>(elemBlock);
-            for (int i = 0; i < _len; i++) {
-                *tb++ ^= ((char *)_register)[i];
-            }
+    _writer |= 1;
 
-            rc = _cipher->encrypt(elemBlock, _len);
+    if ((len % _len) >0) {
+        qCDebug(KWALLETBACKEND_LOG) << "Block length given encrypt (" << len << ") is not a multiple of " << _len;
+        return -1;
+    }
 
-            if (rc != -1) {
-                memcpy(_register, elemBlock, _len);
-            }
-            elemBlock += _len;
+    char *elemBlock = static_cast<char*>(block);
+    for (int b = 0; b < len/_len; b++) {
+
+        // This might be optimizable
+        char *tb = static_cast<char*>(elemBlock);
+        for (int i = 0; i < _len; i++) {
+            *tb++ ^= ((char *)_register)[i];
         }
 
-        return rc;
+        rc = _cipher->encrypt(elemBlock, _len);
+
+        if (rc != -1) {
+            memcpy(_register, elemBlock, _len);
+        }
+        elemBlock += _len;
     }
-    return -1;
+
+    return rc;
 }
 
 // This is the old decrypt method, that was decrypting using ECB
@@ -148,6 +170,63 @@ int CipherBlockChain::decryptECB(void *block, int len) {
     return -1;
 }
 
+// Runs of blocks the XOR is applied to at once
+#define KWALLET_CBC_RUN_BLOCKS 64
+
+// Below this size the thread pool isn't worth it
+#define KWALLET_CBC_PARALLEL_MIN (256 * 1024)
+
+// XORs @p src into @p dst a word at a time, which compilers turn into
+// vector instructions.
+static void xorBytes(char *dst, const char *src, int len)
+{
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        quint64 a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+// Decrypts a part of a chain in place. @p iv is the ciphertext block before
+// it. Each plaintext block only depends on its ciphertext block and the one
+// before, so the parts of a buffer can be decrypted independently.
+int CipherBlockChain::decryptBlocks(char *block, int len, const char *iv) const
+{
+    // the previous ciphertext block, followed by the blocks of the run
+    // before they are decrypted
+    QVarLengthArray<char, 8 * (KWALLET_CBC_RUN_BLOCKS + 1)> prev(_len * (KWALLET_CBC_RUN_BLOCKS + 1));
+    memcpy(prev.data(), iv, _len);
+
+    int rc = 0;
+    for (int done = 0; done < len;) {
+        const int run = qMin(len - done, _len * KWALLET_CBC_RUN_BLOCKS);
+        char *data = block + done;
+        memcpy(prev.data() + _len, data, run);
+
+        const int bytesDecrypted = _cipher->decrypt(data, run);
+        if (bytesDecrypted == -1) {
+            rc = -1;
+        } else {
+            if (rc != -1) {
+                rc += bytesDecrypted;
+            }
+            xorBytes(data, prev.constData(), run);
+        }
+
+        memcpy(prev.data(), prev.constData() + run, _len);
+        done += run;
+    }
+
+    memset(prev.data(), 0, prev.size());
+    return rc;
+}
+
 int CipherBlockChain::decrypt(void *block, int len)
 {
     if (_useECBforReading) {
@@ -156,8 +235,6 @@ int CipherBlockChain::decrypt(void *block, int len)
     }
 
     if (_cipher && !_writer) {
-        int rc = 0;
-
         _reader |= 1;
 
         initRegister();
@@ -167,34 +244,50 @@ int CipherBlockChain::decrypt(void *block, int len)
             return -1;
         }
 
-        char *elemBlock = static_cast<char*>(block);
-        for (int b = 0; b < len/_len; b++) {
-            if (_next == nullptr) {
-                _next = new unsigned char[_len];
-            }
-            memcpy(_next, elemBlock, _len);
+        char *data = static_cast<char *>(block);
+        const int threads = QThread::idealThreadCount();
+        if (len < KWALLET_CBC_PARALLEL_MIN || threads < 2) {
+            return decryptBlocks(data, len, static_cast<char *>(_register));
+        }
 
-            int bytesDecrypted = _cipher->decrypt(elemBlock, _len);
+        // Split the buffer across the thread pool. The ciphertext block
+        // before each part is saved first, since the previous part is
+        // decrypted in place meanwhile.
+        const int parts = qMin(threads, len / (KWALLET_CBC_PARALLEL_MIN / 4));
+        const int partLen = (len / _len + parts - 1) / parts * _len;
+        QByteArray ivs(parts * _len, 0);
+        memcpy(ivs.data(), _register, _len);
+        for (int p = 1; p < parts; ++p) {
+            memcpy(ivs.data() + p * _len, data + p * partLen - _len, _len);
+        }
 
-            if (bytesDecrypted != -1) {
-                rc += bytesDecrypted;
-                // This might be optimizable
-                char *tb = (char *)elemBlock;
-                for (int i = 0; i < _len; i++) {
-                    *tb++ ^= ((char *)_register)[i];
-                }
+        QVector<int> results(parts, 0);
+        QSemaphore done;
+        int started = 0;
+        for (int p = parts - 1; p > 0; --p) {
+            auto decryptPart = [this, data, len, partLen, p, &ivs, &results, &done]() {
+                results[p] = decryptBlocks(data + p * partLen, qMin(partLen, len - p * partLen), ivs.constData() + p * _len);
+                done.release();
+            };
+            // the pool may be busy, with threads possibly waiting on us
+            if (QThreadPool::globalInstance()->tryStart(decryptPart)) {
+                ++started;
+            } else {
+                results[p] = decryptBlocks(data + p * partLen, qMin(partLen, len - p * partLen), ivs.constData() + p * _len);
             }
-
-            void *temp;
-            temp = _next;
-            _next = _register;
-            _register = temp;
-
-            elemBlock += _len;
         }
+        results[0] = decryptBlocks(data, partLen, ivs.constData());
+        done.acquire(started);
+        ivs.fill(0);
 
+        int rc = 0;
+        for (int r : qAsConst(results)) {
+            if (r == -1) {
+                return -1;
+            }
+            rc += r;
+        }
         return rc;
     }
     return -1;
 }
-
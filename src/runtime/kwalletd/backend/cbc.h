@@ -35,10 +35,18 @@ public:
 
     int encrypt(void *block, int len) override;
 
+    // Encrypts the blocks following those of the previous call, instead of
+    // starting a new chain, so data can be encrypted a chunk at a time.
+    int encryptMore(void *block, int len);
+
+    // Large buffers are decrypted by several threads. The cipher's decrypt()
+    // must not modify it, as is the case of BlowFish.
     int decrypt(void *block, int len) override;
 
 private:
     void initRegister();
+    int encryptBlocks(void *block, int len);
+    int decryptBlocks(char *block, int len, const char *iv) const;
     int decryptECB(void *block, int len);
 
     BlockCipher *_cipher;
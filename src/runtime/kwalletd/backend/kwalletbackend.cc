@@ -18,33 +18,36 @@
 #include <KNotification>
 #include <KLocalizedString>
 
+#include <QDataStream>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QSaveFile>
-#include <QCryptographicHash>
 #include <QRegularExpression>
 #include <QStandardPaths>
+#include <QThreadPool>
 
 #include "blowfish.h"
 #include "sha1.h"
 #include "cbc.h"
+#include "kwalletsyncjob.h"
 
 #include <assert.h>
 
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
 // quick fix to get random numbers on win32
 #ifdef Q_OS_WIN //krazy:exclude=cpp
 #include <windows.h>
 #include <wincrypt.h>
 #endif
 
-#define KWALLET_VERSION_MAJOR       0
 #define KWALLET_VERSION_MINOR       1
 
 using namespace KWallet;
 
-#define KWMAGIC "KWALLET\n\r\0\r\n"
-
 class Backend::BackendPrivate
 {
 };
@@ -71,9 +74,11 @@ Backend::Backend(const QString &name, bool isPath)
 
 Backend::~Backend()
 {
+    finishSync();
     if (_open) {
         close();
     }
+    releaseBlowfish();
     delete d;
 }
 
@@ -314,6 +319,9 @@ int Backend::openPreHashed(const QByteArray &passwordHash)
 
 int Backend::openInternal(WId w)
 {
+    _journal.reset();
+    _contentsOutdated = true;
+
     // No wallet existed.  Let's create it.
     // Note: 60 bytes is presently the minimum size of a wallet file.
     //       Anything smaller is junk and should be deleted.
@@ -324,6 +332,7 @@ int Backend::openInternal(WId w)
         }
         newfile.close();
         _open = true;
+        markDirty();
         if (sync(w) != 0) {
             return -2;
         }
@@ -349,7 +358,7 @@ int Backend::openInternal(WId w)
     }
 
     //0 has been the MINOR version until 4.13, from that point we use it to upgrade the hash
-    if (magicBuf[1] == 1) {
+    if (magicBuf[1] == 1 || magicBuf[1] == KWALLET_VERSION_SEGMENTED) {
         qCDebug(KWALLETBACKEND_LOG) << "Wallet new enough, using new hash";
         swapToNewHash();
     } else if (magicBuf[1] != 0) {
@@ -361,11 +370,173 @@ int Backend::openInternal(WId w)
     if (nullptr == phandler) {
         return -41; // unknown cipher or hash
     }
+    _fileVersion = QByteArray(magicBuf, 4);
     int result = phandler->read(this, db, w);
+    const bool journaled = _journal.isValid();
+    if (journaled) {
+        // without the password, at least keep the digests up to date
+        replayJournal(db, phandler, result == 0);
+    }
     delete phandler;
+
+    // What was replayed is on disk already. A broken record has to go,
+    // though.
+    _syncedGeneration = _generation;
+    if (journaled && !_journal.isValid()) {
+        markDirty();
+    }
+
+    if (result == 0) {
+        // wallets using an older cipher are rewritten on the next sync
+        phandler = BackendPersistHandler::getPersistHandler(_cipherType);
+        if (phandler && phandler->cipher() != magicBuf[2]) {
+            _journal.invalidate();
+            markDirty();
+        }
+        delete phandler;
+    }
     return result;
 }
 
+void Backend::replayJournal(QFile &db, BackendPersistHandler *phandler, bool decrypted)
+{
+    const QString folder = _folder;
+    QVector<Journal::DigestOp> ops;
+    QByteArray sealed;
+
+    _journal.setRecording(false);
+    while (!db.atEnd()) {
+        const qint64 start = db.pos();
+        if (!Journal::readRecord(&db, ops, sealed)) {
+            break;
+        }
+
+        if (decrypted) {
+            QByteArray payload;
+            const bool ok = phandler->openBlock(this, sealed, payload) == 0 && applyJournalRecord(payload);
+            payload.fill(0);
+            if (!ok) {
+                break;
+            }
+        } else {
+            Journal::applyDigests(_hashes, ops);
+        }
+        _journal.committed(db.pos() - start);
+    }
+    _journal.setRecording(true);
+    setFolder(folder);
+
+    if (!db.atEnd()) {
+        // Most likely an interrupted sync. The next one rewrites the wallet,
+        // which drops the broken record.
+        qCDebug(KWALLETBACKEND_LOG) << "Ignoring invalid journal record in" << _path;
+        _journal.invalidate();
+    }
+}
+
+bool Backend::applyJournalRecord(const QByteArray &payload)
+{
+    struct Op {
+        quint8 op;
+        QString folder;
+        QString key;
+        qint32 type;
+        QByteArray value;
+    };
+
+    QDataStream stream(payload);
+    quint32 sequence = 0;
+    quint32 count = 0;
+    stream >> sequence >> count;
+    if (stream.status() != QDataStream::Ok || sequence != static_cast<quint32>(_journal.recordCount())) {
+        return false;
+    }
+
+    // a record is applied entirely or not at all
+    QVector<Op> ops;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        Op o;
+        o.type = 0;
+        stream >> o.op >> o.folder >> o.key;
+        if (o.op == Journal::WriteEntry) {
+            stream >> o.type >> o.value;
+        }
+        ops.append(o);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        for (Op &o : ops) {
+            o.value.fill(0);
+        }
+        return false;
+    }
+
+    for (Op &o : ops) {
+        if ((o.op == Journal::WriteEntry || o.op == Journal::RemoveEntry) && hasFolder(o.folder)) {
+            setFolder(o.folder);
+            if (isFolderEncrypted(o.folder)) {
+                // The folder can't be decrypted, the rest of the wallet
+                // still opens. The change is kept for the next rewrite.
+                qCWarning(KWALLETBACKEND_LOG) << "Keeping a journaled change to folder" << o.folder << "of" << _path << "which can't be decrypted";
+                holdOp(static_cast<Journal::Operation>(o.op), o.folder, o.key, o.type, o.value);
+                o.value.fill(0);
+                continue;
+            }
+        }
+
+        switch (o.op) {
+        case Journal::WriteEntry: {
+            Entry e;
+            e.setKey(o.key);
+            e.setType(static_cast<KWallet::Wallet::EntryType>(o.type));
+            e.setValue(o.value);
+            setFolder(o.folder);
+            writeEntry(&e);
+            break;
+        }
+        case Journal::RemoveEntry:
+            setFolder(o.folder);
+            removeEntry(o.key);
+            break;
+        case Journal::CreateFolder:
+            createFolder(o.folder);
+            break;
+        case Journal::RemoveFolder:
+            removeFolder(o.folder);
+            break;
+        default:
+            break;
+        }
+        o.value.fill(0);
+    }
+    return true;
+}
+
+void Backend::holdOp(Journal::Operation op, const QString &folder, const QString &key, qint32 type, const QByteArray &value)
+{
+    const HeldOp h = {{op, folder, key, _entries.folderDigest(folder), _entries.keyDigest(folder, key)}, type, value};
+    _heldOps.append(h);
+
+    // the digest table written with the folder has to list the key
+    if (op == Journal::WriteEntry) {
+        _hashes[h.op.folderDigest].insert(h.op.keyDigest);
+    } else {
+        HashMap::iterator i = _hashes.find(h.op.folderDigest);
+        if (i != _hashes.end()) {
+            i.value().remove(h.op.keyDigest);
+        }
+    }
+}
+
+void Backend::dropHeldOps(const QString &folder)
+{
+    for (int i = _heldOps.count() - 1; i >= 0; --i) {
+        if (folder.isNull() || _heldOps.at(i).op.folder == folder) {
+            _heldOps[i].value.fill(0);
+            _heldOps.remove(i);
+        }
+    }
+}
+
 void Backend::swapToNewHash()
 {
     //Runtime error happened and we can't use the new hash
@@ -377,6 +548,34 @@ void Backend::swapToNewHash()
     _passhash = _newPassHash;//Use the new hash, means the wallet is modern enough
 }
 
+BlowFish *Backend::blowfish()
+{
+    const int bitlength = _passhash.size() * 8;
+    if (_blowfish && _blowfish->hasKey(_passhash.constData(), bitlength)) {
+        return _blowfish;
+    }
+
+    if (!_blowfish) {
+        _blowfish = new BlowFish;
+    }
+
+    if (!_blowfish->setKey(_passhash.data(), bitlength)) {
+        return nullptr;
+    }
+    return _blowfish;
+}
+
+void Backend::releaseBlowfish()
+{
+    if (!_blowfish) {
+        return;
+    }
+
+    // the destructor wipes the key and its schedule
+    delete _blowfish;
+    _blowfish = nullptr;
+}
+
 QByteArray Backend::createAndSaveSalt(const QString &path) const
 {
     QFile saltFile(path);
@@ -402,14 +601,157 @@ QByteArray Backend::createAndSaveSalt(const QString &path) const
 
 int Backend::sync(WId w)
 {
+    finishSync();
     if (!_open) {
         return -255;  // not open yet
     }
 
+    if (!isDirty()) {
+        return 0; // nothing changed since the last sync
+    }
+
     if (!QFile::exists(_path)) {
         return -3; // File does not exist
     }
 
+    if (_journal.canAppend()) {
+        const int rc = appendJournal();
+        if (rc == 0) {
+            _syncedGeneration = _generation;
+            return 0;
+        }
+        if (_appendOnly) {
+            // there is nothing else to write, the wallet is rewritten by
+            // the next sync
+            return rc;
+        }
+        // the rewrite also gets rid of a partially appended record
+        qCDebug(KWALLETBACKEND_LOG) << "Appending to the journal failed, rewriting" << _path;
+    }
+
+    int rc = writeWallet(w);
+    if (rc == 0) {
+        _syncedGeneration = _generation;
+    }
+    return rc;
+}
+
+int Backend::compact(WId w)
+{
+    finishSync();
+    if (!_open) {
+        return -255;  // not open yet
+    }
+
+    if (!QFile::exists(_path)) {
+        return -3; // File does not exist
+    }
+
+    int rc = writeWallet(w);
+    if (rc == 0) {
+        _syncedGeneration = _generation;
+    }
+    return rc;
+}
+
+bool Backend::needsCompaction() const
+{
+    return _open && _journal.isCompactionDue();
+}
+
+int Backend::appendJournal()
+{
+    // Entries are written with their current value. Those which are gone
+    // by now are skipped, a later operation removes them anyway.
+    QVector<Journal::Op> ops;
+    QVector<const Entry *> entries;
+    for (const Journal::Op &op : _journal.pending()) {
+        const Entry *e = nullptr;
+        if (op.op == Journal::WriteEntry) {
+            e = _entries.value(op.folder, op.key);
+            if (!e) {
+                continue;
+            }
+        }
+        ops.append(op);
+        entries.append(e);
+    }
+
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << static_cast<quint32>(_journal.recordCount());
+    stream << static_cast<quint32>(ops.count());
+    for (int i = 0; i < ops.count(); ++i) {
+        stream << static_cast<quint8>(ops.at(i).op) << ops.at(i).folder << ops.at(i).key;
+        if (entries.at(i)) {
+            stream << static_cast<qint32>(entries.at(i)->type()) << entries.at(i)->value();
+        }
+    }
+
+    const int rc = appendRecord(ops, payload);
+    payload.fill(0);
+    return rc;
+}
+
+int Backend::appendHeldOps()
+{
+    QVector<Journal::Op> ops;
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << static_cast<quint32>(_journal.recordCount());
+    stream << static_cast<quint32>(_heldOps.count());
+    for (const HeldOp &h : qAsConst(_heldOps)) {
+        ops.append(h.op);
+        stream << static_cast<quint8>(h.op.op) << h.op.folder << h.op.key;
+        if (h.op.op == Journal::WriteEntry) {
+            stream << h.type << h.value;
+        }
+    }
+
+    const int rc = appendRecord(ops, payload);
+    payload.fill(0);
+    return rc;
+}
+
+int Backend::appendRecord(const QVector<Journal::Op> &ops, const QByteArray &payload)
+{
+    // records are sealed like the rest of the file
+    BackendPersistHandler *phandler = BackendPersistHandler::getPersistHandler(_fileVersion.data());
+    if (nullptr == phandler) {
+        return -4; // write error
+    }
+
+    QByteArray sealed;
+    int rc = phandler->sealBlock(this, payload, sealed);
+    delete phandler;
+    if (rc < 0) {
+        return rc;
+    }
+
+    const QByteArray record = Journal::frame(ops, sealed);
+
+    QFile f(_path);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        return -1; // error opening file
+    }
+    if (f.size() != _journal.baseSize() + _journal.size()) {
+        return -4; // not the file we last wrote
+    }
+    if (f.write(record) != record.size() || !f.flush()) {
+        return -4; // write error
+    }
+#ifdef Q_OS_UNIX
+    if (::fsync(f.handle()) != 0) {
+        return -4; // write error
+    }
+#endif
+
+    _journal.committed(record.size());
+    return 0;
+}
+
+int Backend::writeWallet(WId w)
+{
     QSaveFile sf(_path);
 
     if (!sf.open(QIODevice::WriteOnly | QIODevice::Unbuffered)) {
@@ -422,60 +764,277 @@ int Backend::sync(WId w)
         return -4; // write error
     }
 
+    BackendPersistHandler *phandler = BackendPersistHandler::getPersistHandler(_cipherType);
+    if (nullptr == phandler) {
+        return -4; // write error
+    }
+
     // Write the version number
     QByteArray version(4, 0);
     version[0] = KWALLET_VERSION_MAJOR;
     if (_useNewHash) {
-        version[1] = KWALLET_VERSION_MINOR;
+        version[1] = phandler->supportsSegments() ? KWALLET_VERSION_SEGMENTED : KWALLET_VERSION_MINOR;
         //Use the sync to update the hash to PBKDF2_SHA512
         swapToNewHash();
     } else {
         version[1] = 0; //was KWALLET_VERSION_MINOR before the new hash
     }
 
-    BackendPersistHandler *phandler = BackendPersistHandler::getPersistHandler(_cipherType);
-    if (nullptr == phandler) {
+    // the other formats need every folder in clear, and segments sealed with
+    // another cipher have to be sealed again
+    const bool migrating = !_fileVersion.isEmpty() && _fileVersion.at(2) != phandler->cipher();
+    if ((version[1] != KWALLET_VERSION_SEGMENTED || migrating) && !decryptAllFolders()) {
+        sf.cancelWriting();
+        delete phandler;
         return -4; // write error
     }
+    if (migrating) {
+        _segments.clear();
+    }
+
     int rc = phandler->write(this, sf, version, w);
-    if (rc < 0) {
-        // Oops! wallet file sync filed! Display a notification about that
-        // TODO: change kwalletd status flags, when status flags will be implemented
-        KNotification *notification = new KNotification(QStringLiteral("syncFailed"));
-        notification->setText(i18n("Failed to sync wallet <b>%1</b> to disk. Error codes are:\nRC <b>%2</b>\nSF <b>%3</b>. Please file a BUG report using this information to bugs.kde.org", _name, rc, sf.errorString()));
-        notification->sendEvent();
+    if (rc == 0) {
+        _fileVersion = version;
+        if (version[1] == KWALLET_VERSION_SEGMENTED) {
+            _journal.setBase(QFileInfo(_path).size());
+            // changes to folders which couldn't be decrypted aren't in the
+            // base image
+            if (!_heldOps.isEmpty() && appendHeldOps() != 0) {
+                qCWarning(KWALLETBACKEND_LOG) << "Cannot append the changes to folders which can't be decrypted to" << _path;
+                _journal.invalidate();
+            }
+        } else {
+            _journal.reset();
+        }
+    } else {
+        // Oops! wallet file sync filed! Display a notification about that,
+        // from the main thread in the case of a snapshot
+        _syncError = sf.errorString();
+        if (!_isSnapshot) {
+            notifySyncFailed(rc, _syncError);
+        }
     }
     delete phandler;
     return rc;
 }
 
+void Backend::notifySyncFailed(int rc, const QString &error) const
+{
+    // TODO: change kwalletd status flags, when status flags will be implemented
+    KNotification *notification = new KNotification(QStringLiteral("syncFailed"));
+    notification->setText(i18n("Failed to sync wallet <b>%1</b> to disk. Error codes are:\nRC <b>%2</b>\nSF <b>%3</b>. Please file a BUG report using this information to bugs.kde.org", _name, rc, error));
+    notification->sendEvent();
+}
+
+void Backend::folderChanged(const QString &f)
+{
+    markDirty();
+    _segments.remove(f);
+    _outdatedFolders.insert(f);
+    if (_syncJob) {
+        _changedFolders.insert(f);
+    }
+}
+
+bool Backend::syncsInBackground() const
+{
+    return _cipherType == BACKEND_CIPHER_BLOWFISH;
+}
+
+Backend *Backend::snapshot(bool compact)
+{
+    Backend *s = new Backend(_name);
+    s->_path = _path;
+    s->_open = true;
+    s->_isSnapshot = true;
+    s->_useNewHash = _useNewHash;
+    s->_lazyLoading = _lazyLoading;
+    s->_passhash = _passhash;
+    s->_newPassHash = _newPassHash;
+    s->_cipherType = _cipherType;
+    s->_fileVersion = _fileVersion;
+    s->_journal = _journal;
+    s->_generation = _generation;
+    s->_syncedGeneration = _syncedGeneration;
+#ifdef HAVE_GPGMEPP
+    s->_gpgKey = _gpgKey;
+#endif
+
+    if (!compact && _journal.canAppend()) {
+        // A record only needs the values it writes, so the copy costs as
+        // much as the changes rather than the whole wallet.
+        s->_appendOnly = true;
+        for (const Journal::Op &op : _journal.pending()) {
+            const Entry *e = op.op == Journal::WriteEntry ? _entries.value(op.folder, op.key) : nullptr;
+            if (e && !s->_entries.value(op.folder, op.key)) {
+                Entry *copy = s->_arena.create();
+                copy->copy(e);
+                s->_entries.insert(op.folder, op.key, copy);
+            }
+        }
+        return s;
+    }
+
+    s->_hashes = _hashes;
+    s->_segments = _segments;
+    s->_encryptedFolders = _encryptedFolders;
+    s->_heldOps = _heldOps;
+
+    // The digests are worked out here once, rather than by every snapshot.
+    // Values are implicitly shared, or still in the decrypted payload,
+    // which is only read until nothing references it.
+    _entries.computeDigests();
+    s->_entries = _entries;
+    s->_entries.transform([s](const Entry *e) {
+        Entry *copy = s->_arena.create();
+        copy->copy(e);
+        return copy;
+    });
+    return s;
+}
+
+SyncJob *Backend::startSync(bool compact)
+{
+    if (!_open || _syncJob || !syncsInBackground()) {
+        return nullptr;
+    }
+    if (!compact && !isDirty()) {
+        return nullptr; // nothing changed since the last sync
+    }
+
+    Backend *s = snapshot(compact);
+    _syncJob = new SyncJob(s, compact);
+    _syncJob->_appendOnly = s->_appendOnly;
+    _changedFolders.clear();
+    // the snapshot writes these, the changes made from now on are recorded
+    // again
+    _journal.clearPending();
+    QThreadPool::globalInstance()->start(_syncJob);
+    return _syncJob;
+}
+
+int Backend::finishSync()
+{
+    if (!_syncJob) {
+        return 0;
+    }
+
+    _syncJob->wait();
+    const int rc = _syncJob->result();
+    Backend *s = _syncJob->_snapshot;
+    _syncJob->_snapshot = nullptr;
+    // finished() may still be on its way to the main thread
+    _syncJob->deleteLater();
+    _syncJob = nullptr;
+
+    if (rc != 0) {
+        // the changes written by the snapshot are only on record in memory
+        _journal.invalidate();
+        _changedFolders.clear();
+        if (!s->_syncError.isNull()) {
+            notifySyncFailed(rc, s->_syncError);
+        }
+        delete s;
+        return rc;
+    }
+
+    // The segments sealed by the snapshot hold the folders that didn't
+    // change since. After a switch to another cipher, the others can't be
+    // reused.
+    if (_fileVersion.isEmpty() || _fileVersion.at(2) != s->_fileVersion.at(2)) {
+        _segments.clear();
+    }
+    for (SegmentMap::ConstIterator i = s->_segments.constBegin(); i != s->_segments.constEnd(); ++i) {
+        if (!_changedFolders.contains(i.key()) && _entries.hasFolder(i.key())) {
+            _segments.insert(i.key(), i.value());
+        }
+    }
+    const bool changed = !_changedFolders.isEmpty();
+    _changedFolders.clear();
+    _syncedGeneration = s->_syncedGeneration;
+    _fileVersion = s->_fileVersion;
+    if (_passhash != s->_passhash) {
+        // the rewrite switched to the new hash
+        _passhash.fill(0);
+        _passhash = s->_passhash;
+    }
+
+    // The changes made meanwhile come on top of the file just written, as
+    // long as all of them were recorded.
+    const QVector<Journal::Op> newer = _journal.pending();
+    const bool recorded = _journal.isValid();
+    _journal = s->_journal;
+    if (changed) {
+        if (recorded && _journal.isValid()) {
+            for (const Journal::Op &op : newer) {
+                _journal.record(op.op, op.folder, op.folderDigest, op.key, op.keyDigest);
+            }
+        } else {
+            _journal.invalidate();
+        }
+    }
+
+    delete s;
+    return 0;
+}
+
 int Backend::close(bool save)
 {
+    finishSync();
+
     // save if requested
     if (save) {
-        int rc = sync(0);
+        int rc = needsCompaction() ? compact(0) : sync(0);
         if (rc != 0) {
             return rc;
         }
     }
 
-    // do the actual close
-    for (FolderMap::ConstIterator i = _entries.constBegin(); i != _entries.constEnd(); ++i) {
-        for (EntryMap::ConstIterator j = i.value().constBegin(); j != i.value().constEnd(); ++j) {
-            delete j.value();
-        }
-    }
-    _entries.clear();
+    // do the actual close; versions still used elsewhere keep what they
+    // reference
+    Contents::store(_contents, Contents());
+    _contentsOutdated = true;
+    _outdatedFolders.clear();
+    _entries.takeAll();
+    _arena.clear();
+    _segments.clear();
+    _encryptedFolders.clear();
+    dropHeldOps();
+    _journal.reset();
+    _fileVersion.clear();
 
     // empty the password hash
     _passhash.fill(0);
     _newPassHash.fill(0);
+    releaseBlowfish();
 
     _open = false;
 
     return 0;
 }
 
+Contents Backend::contents()
+{
+    if (!_open) {
+        return Contents();
+    }
+
+    if (_contentsOutdated) {
+        const QStringList folders = _entries.folderList();
+        QSet<QString> all;
+        all.reserve(folders.count());
+        for (const QString &f : folders) {
+            all.insert(f);
+        }
+        Contents::store(_contents, Contents().updated(_entries, _encryptedFolders, all, _generation));
+    } else if (!_outdatedFolders.isEmpty()) {
+        Contents::store(_contents, _contents.updated(_entries, _encryptedFolders, _outdatedFolders, _generation));
+    }
+    _contentsOutdated = false;
+    _outdatedFolders.clear();
+    return _contents;
+}
+
 const QString &Backend::walletName() const
 {
     return _name;
@@ -488,20 +1047,20 @@ bool Backend::isOpen() const
 
 QStringList Backend::folderList() const
 {
-    return _entries.keys();
+    return _entries.folderList();
 }
 
 QStringList Backend::entryList() const
 {
-    return _entries[_folder].keys();
+    return _entries.keys(_folder);
 }
 
 Entry *Backend::readEntry(const QString &key)
 {
     Entry *rc = nullptr;
 
-    if (_open && hasEntry(key)) {
-        rc = _entries[_folder][key];
+    if (_open) {
+        rc = _entries.value(_folder, key);
     }
 
     return rc;
@@ -521,10 +1080,10 @@ QList<Entry *> Backend::readEntryList(const QString &key)
                                                          QLatin1String("[^/]"), QLatin1String("."));
     const QRegularExpression re(pattern);
 
-    const EntryMap &map = _entries[_folder];
-    for (EntryMap::ConstIterator i = map.begin(); i != map.end(); ++i) {
-        if (re.match(i.key()).hasMatch()) {
-            rc.append(i.value());
+    const QVector<EntryIndex::Item> items = _entries.items(_folder);
+    for (const EntryIndex::Item &i : items) {
+        if (re.match(i.first).hasMatch()) {
+            rc.append(i.second);
         }
     }
     return rc;
@@ -536,48 +1095,79 @@ QList<Entry *> Backend::entriesList() const
     if (!_open) {
         return QList<Entry *>();
     }
-    const EntryMap &map = _entries[_folder];
 
-    return map.values();
+    return _entries.values(_folder);
 }
 
 
-bool Backend::createFolder(const QString &f)
+void Backend::setFolder(const QString &f)
 {
-    if (_entries.contains(f)) {
+    _folder = f;
+    if (_encryptedFolders.contains(f)) {
+        decryptFolder(f);
+    }
+}
+
+bool Backend::decryptFolder(const QString &f)
+{
+    BackendPersistHandler *phandler = BackendPersistHandler::getPersistHandler(_fileVersion.data());
+    if (nullptr == phandler) {
         return false;
     }
+    int rc = phandler->readFolder(this, f);
+    delete phandler;
+    if (rc < 0) {
+        // the folder stays encrypted and is written back as it was read
+        qCWarning(KWALLETBACKEND_LOG) << "Cannot decrypt folder" << f << "of wallet" << _name << "- error" << rc;
+        return false;
+    }
+    _outdatedFolders.insert(f);
+    return true;
+}
 
-    _entries.insert(f, EntryMap());
+bool Backend::decryptAllFolders()
+{
+    bool ok = true;
+    const QStringList folders = _encryptedFolders.values();
+    for (const QString &f : folders) {
+        ok = decryptFolder(f) && ok;
+    }
+    return ok;
+}
 
-    QCryptographicHash folderMd5(QCryptographicHash::Md5);
-    folderMd5.addData(f.toUtf8());
-    _hashes.insert(MD5Digest(folderMd5.result()), QList<MD5Digest>());
+bool Backend::createFolder(const QString &f)
+{
+    if (!_entries.insertFolder(f)) {
+        return false;
+    }
+
+    const MD5Digest folderDigest = _entries.folderDigest(f);
+    _journal.record(Journal::CreateFolder, f, folderDigest);
+    folderChanged(f);
+    _hashes.insert(folderDigest, DigestSet());
 
     return true;
 }
 
 int Backend::renameEntry(const QString &oldName, const QString &newName)
 {
-    EntryMap &emap = _entries[_folder];
-    EntryMap::Iterator oi = emap.find(oldName);
-    EntryMap::Iterator ni = emap.find(newName);
-
-    if (oi != emap.end() && ni == emap.end()) {
-        Entry *e = oi.value();
-        emap.erase(oi);
-        emap[newName] = e;
+    if (_encryptedFolders.contains(_folder)) {
+        return -1;
+    }
 
-        QCryptographicHash folderMd5(QCryptographicHash::Md5);
-        folderMd5.addData(_folder.toUtf8());
+    if (_entries.value(_folder, oldName) && !_entries.value(_folder, newName)) {
+        const MD5Digest folderDigest = _entries.folderDigest(_folder);
+        const MD5Digest oldDigest = _entries.keyDigest(_folder, oldName);
+        _entries.insert(_folder, newName, _entries.take(_folder, oldName));
+        const MD5Digest newDigest = _entries.keyDigest(_folder, newName);
+        folderChanged(_folder);
+        _journal.record(Journal::RemoveEntry, _folder, folderDigest, oldName, oldDigest);
+        _journal.record(Journal::WriteEntry, _folder, folderDigest, newName, newDigest);
 
-        HashMap::iterator i = _hashes.find(MD5Digest(folderMd5.result()));
+        HashMap::iterator i = _hashes.find(folderDigest);
         if (i != _hashes.end()) {
-            QCryptographicHash oldMd5(QCryptographicHash::Md5), newMd5(QCryptographicHash::Md5);
-            oldMd5.addData(oldName.toUtf8());
-            newMd5.addData(newName.toUtf8());
-            i.value().removeAll(MD5Digest(oldMd5.result()));
-            i.value().append(MD5Digest(newMd5.result()));
+            i.value().remove(oldDigest);
+            i.value().insert(newDigest);
         }
         return 0;
     }
@@ -585,53 +1175,50 @@ int Backend::renameEntry(const QString &oldName, const QString &newName)
     return -1;
 }
 
-void Backend::writeEntry(Entry *e)
+bool Backend::writeEntry(Entry *e)
 {
-    if (!_open) {
-        return;
+    if (!_open || _encryptedFolders.contains(_folder)) {
+        return false;
     }
 
-    if (!hasEntry(e->key())) {
-        _entries[_folder][e->key()] = new Entry;
+    Entry *entry = _entries.value(_folder, e->key());
+    if (!entry) {
+        entry = _arena.create();
+        _entries.insert(_folder, e->key(), entry);
     }
-    _entries[_folder][e->key()]->copy(e);
+    entry->copy(e);
+    folderChanged(_folder);
 
-    QCryptographicHash folderMd5(QCryptographicHash::Md5);
-    folderMd5.addData(_folder.toUtf8());
+    const MD5Digest folderDigest = _entries.folderDigest(_folder);
+    const MD5Digest keyDigest = _entries.keyDigest(_folder, e->key());
+    _journal.record(Journal::WriteEntry, _folder, folderDigest, e->key(), keyDigest);
 
-    HashMap::iterator i = _hashes.find(MD5Digest(folderMd5.result()));
-    if (i != _hashes.end()) {
-        QCryptographicHash md5(QCryptographicHash::Md5);
-        md5.addData(e->key().toUtf8());
-        i.value().append(MD5Digest(md5.result()));
-    }
+    // the entry creates its folder if needed
+    _hashes[folderDigest].insert(keyDigest);
+    return true;
 }
 
 bool Backend::hasEntry(const QString &key) const
 {
-    return _entries.contains(_folder) && _entries[_folder].contains(key);
+    return _entries.value(_folder, key) != nullptr;
 }
 
 bool Backend::removeEntry(const QString &key)
 {
-    if (!_open) {
+    if (!_open || _encryptedFolders.contains(_folder)) {
         return false;
     }
 
-    FolderMap::Iterator fi = _entries.find(_folder);
-    EntryMap::Iterator ei = fi.value().find(key);
+    if (_entries.value(_folder, key)) {
+        const MD5Digest folderDigest = _entries.folderDigest(_folder);
+        const MD5Digest keyDigest = _entries.keyDigest(_folder, key);
+        _arena.destroy(_entries.take(_folder, key));
+        folderChanged(_folder);
+        _journal.record(Journal::RemoveEntry, _folder, folderDigest, key, keyDigest);
 
-    if (fi != _entries.end() && ei != fi.value().end()) {
-        delete ei.value();
-        fi.value().erase(ei);
-        QCryptographicHash folderMd5(QCryptographicHash::Md5);
-        folderMd5.addData(_folder.toUtf8());
-
-        HashMap::iterator i = _hashes.find(MD5Digest(folderMd5.result()));
+        HashMap::iterator i = _hashes.find(folderDigest);
         if (i != _hashes.end()) {
-            QCryptographicHash md5(QCryptographicHash::Md5);
-            md5.addData(key.toUtf8());
-            i.value().removeAll(MD5Digest(md5.result()));
+            i.value().remove(keyDigest);
         }
         return true;
     }
@@ -645,22 +1232,21 @@ bool Backend::removeFolder(const QString &f)
         return false;
     }
 
-    FolderMap::Iterator fi = _entries.find(f);
-
-    if (fi != _entries.end()) {
+    if (_entries.hasFolder(f)) {
         if (_folder == f) {
             _folder.clear();
         }
 
-        for (EntryMap::Iterator ei = fi.value().begin(); ei != fi.value().end(); ++ei) {
-            delete ei.value();
+        const MD5Digest folderDigest = _entries.folderDigest(f);
+        const QList<Entry *> entries = _entries.takeFolder(f);
+        for (Entry *e : entries) {
+            _arena.destroy(e);
         }
-
-        _entries.erase(fi);
-
-        QCryptographicHash folderMd5(QCryptographicHash::Md5);
-        folderMd5.addData(f.toUtf8());
-        _hashes.remove(MD5Digest(folderMd5.result()));
+        folderChanged(f);
+        _encryptedFolders.remove(f);
+        dropHeldOps(f);
+        _journal.record(Journal::RemoveFolder, f, folderDigest);
+        _hashes.remove(folderDigest);
         return true;
     }
 
@@ -669,26 +1255,30 @@ bool Backend::removeFolder(const QString &f)
 
 bool Backend::folderDoesNotExist(const QString &folder) const
 {
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(folder.toUtf8());
-    return !_hashes.contains(MD5Digest(md5.result()));
+    return _hashes.folderDoesNotExist(_entries.folderDigest(folder));
 }
 
 bool Backend::entryDoesNotExist(const QString &folder, const QString &entry) const
 {
-    QCryptographicHash md5(QCryptographicHash::Md5);
-    md5.addData(folder.toUtf8());
-    HashMap::const_iterator i = _hashes.find(MD5Digest(md5.result()));
+    HashMap::const_iterator i = _hashes.find(_entries.folderDigest(folder));
     if (i != _hashes.end()) {
-        md5.reset();
-        md5.addData(entry.toUtf8());
-        return !i.value().contains(MD5Digest(md5.result()));
+        return !i.value().contains(_entries.keyDigest(folder, entry));
     }
     return true;
 }
 
 void Backend::setPassword(const QByteArray &password)
 {
+    finishSync();
+    markDirty();
+
+    // records can't be appended with a different key, nor can segments
+    // sealed with the old one be reused
+    _journal.invalidate();
+    if (_open) {
+        decryptAllFolders();
+    }
+    _segments.clear();
     _passhash.fill(0); // empty just in case
     BlowFish _bf;
     CipherBlockChain bf(&_bf);
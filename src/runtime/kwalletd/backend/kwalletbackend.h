@@ -10,8 +10,15 @@
 
 #include "backendpersisthandler.h"
 #include "kwalletbackend5_export.h"
+#include "kwalletcontents.h"
+#include "kwalletdigestset.h"
 #include "kwalletentry.h"
+#include "kwalletentryarena.h"
+#include "kwalletentryindex.h"
+#include "kwalletjournal.h"
+#include <QHash>
 #include <QMap>
+#include <QSet>
 #include <QString>
 #include <QStringList>
 
@@ -23,47 +30,11 @@
 #define PBKDF2_SHA512_SALTSIZE 56
 #define PBKDF2_SHA512_ITERATIONS 50000
 
+class BlowFish;
+
 namespace KWallet
 {
-/**
- * @internal
- */
-class MD5Digest : public QByteArray
-{
-public:
-    MD5Digest()
-        : QByteArray(16, 0)
-    {
-    }
-    MD5Digest(const char *data)
-        : QByteArray(data, 16)
-    {
-    }
-    MD5Digest(const QByteArray &digest)
-        : QByteArray(digest)
-    {
-    }
-    virtual ~MD5Digest()
-    {
-    }
-
-    int operator<(const MD5Digest &r) const
-    {
-        int i = 0;
-        char x, y;
-        for (; i < 16; ++i) {
-            x = at(i);
-            y = r.at(i);
-            if (x != y) {
-                break;
-            }
-        }
-        if (i < 16 && x < y) {
-            return 1;
-        }
-        return 0;
-    }
-};
+class SyncJob;
 
 /* @internal
  */
@@ -91,11 +62,73 @@ public:
     int close(bool save = false);
 
     // Write the wallet to disk
+    // Changes are appended to the wallet file when possible, see compact().
     int sync(WId w);
 
+    // Rewrite the wallet file, folding in the changes appended by sync().
+    int compact(WId w);
+
+    // Returns true if the wallet file should be compacted.
+    bool needsCompaction() const;
+
+    // Returns true if the wallet changed since it was last written, in
+    // which case sync() has something to do.
+    bool isDirty() const
+    {
+        return _generation != _syncedGeneration;
+    }
+
+    // The number of changes not written yet.
+    quint64 pendingChanges() const
+    {
+        return _generation - _syncedGeneration;
+    }
+
+    // Starts writing the wallet to disk on a worker thread, like sync() or,
+    // if compact is true, compact(). The wallet is copied first and can be
+    // used while the job runs; sync(), compact(), setPassword() and close()
+    // wait for it. Once the job emitted finished(), call finishSync().
+    // Returns null if there is nothing to write or the wallet can't be
+    // written in the background, see syncsInBackground().
+    SyncJob *startSync(bool compact = false);
+
+    // The job started by startSync() until finishSync() is called.
+    SyncJob *syncJob() const
+    {
+        return _syncJob;
+    }
+
+    // Waits for the job started by startSync(), if any, and takes its result
+    // in. Returns the result of the job, 0 if there is none.
+    int finishSync();
+
+    // False for wallets which may have to ask the user something while
+    // they are written, i.e. GPG ones.
+    bool syncsInBackground() const;
+
     // Returns true if the current wallet is open.
     bool isOpen() const;
 
+    // The folders and entries as they are now, for reading on other
+    // threads. The version published last is brought up to date with the
+    // changes made since, which is only done on the thread using the wallet.
+    Contents contents();
+
+    // The version published by the last call to contents(), or an empty one
+    // after close(). Can be called on any thread.
+    Contents publishedContents() const
+    {
+        return Contents::load(_contents);
+    }
+
+    // If true (the default), opening only indexes the folders and keys.
+    // Values are decoded the first time they are accessed and, in wallets
+    // stored as segments, folders are decrypted when they are first used.
+    void setLazyLoading(bool lazy)
+    {
+        _lazyLoading = lazy;
+    }
+
     // Returns the current wallet name.
     const QString &walletName() const;
 
@@ -105,11 +138,8 @@ public:
     // Force creation of a folder.
     bool createFolder(const QString &f);
 
-    // Change the folder.
-    void setFolder(const QString &f)
-    {
-        _folder = f;
-    }
+    // Change the folder, decrypting it if needed.
+    void setFolder(const QString &f);
 
     // Current folder.  If empty, it's the global folder.
     const QString &folder() const
@@ -120,7 +150,14 @@ public:
     // Does it have this folder?
     bool hasFolder(const QString &f) const
     {
-        return _entries.contains(f);
+        return _entries.hasFolder(f);
+    }
+
+    // Is this folder still encrypted, because setFolder() couldn't decrypt
+    // it? Its entries can't be changed then.
+    bool isFolderEncrypted(const QString &f) const
+    {
+        return _encryptedFolders.contains(f);
     }
 
     // Look up an entry.  Returns null if it doesn't exist.
@@ -137,13 +174,15 @@ public:
     // @since 5.72
     QList<Entry *> entriesList() const;
 
-    // Store an entry.
-    void writeEntry(Entry *e);
+    // Store an entry.  Returns false if it wasn't, as the wallet is closed
+    // or the current folder couldn't be decrypted.
+    bool writeEntry(Entry *e);
 
     // Does this folder contain this entry?
     bool hasEntry(const QString &key) const;
 
-    // Returns true if the entry was removed
+    // Returns true if the entry was removed.  It isn't, either, if the
+    // current folder couldn't be decrypted, see isFolderEncrypted().
     bool removeEntry(const QString &key);
 
     // Returns true if the folder was removed
@@ -198,27 +237,85 @@ private:
     QString _path;
     bool _open;
     bool _useNewHash = false;
+    bool _lazyLoading = true;
     QString _folder;
     int _ref = 0;
-    // Map Folder->Entries
-    typedef QMap<QString, Entry *> EntryMap;
-    typedef QMap<QString, EntryMap> FolderMap;
-    FolderMap _entries;
-    typedef QMap<MD5Digest, QList<MD5Digest>> HashMap;
+    EntryArena _arena; // storage of the entries
+    // (Folder, Key)->Entry
+    EntryIndex _entries;
+    // Folder digest->key digests, as in the cleartext table of the file
+    typedef DigestTable HashMap;
     HashMap _hashes;
+    // Folder->sealed segment, for the folders unchanged since they were
+    // read or last written
+    typedef QHash<QString, QByteArray> SegmentMap;
+    SegmentMap _segments;
+    QSet<QString> _encryptedFolders; // folders not decrypted yet
+    // A journaled change to a folder which couldn't be decrypted when the
+    // wallet was opened. It is kept, and appended again after each new base
+    // image, until the folder is removed.
+    struct HeldOp {
+        Journal::Op op;
+        qint32 type;
+        QByteArray value;
+    };
+    QVector<HeldOp> _heldOps;
     QByteArray _passhash; // password hash used for saving the wallet
     QByteArray _newPassHash; // Modern hash using KWALLET_HASH_PBKDF2_SHA512
+    // Blowfish key schedule of _passhash, kept across syncs until close
+    BlowFish *_blowfish = nullptr;
     BackendCipherType _cipherType; // the kind of encryption used for this wallet
+    QByteArray _fileVersion; // version bytes of the wallet file as last read or written
+    Journal _journal; // changes not yet in the base image of the wallet file
+    // bumped by every change; the value of the last one written
+    quint64 _generation = 0;
+    quint64 _syncedGeneration = 0;
+    SyncJob *_syncJob = nullptr;
+    QSet<QString> _changedFolders; // folders changed while _syncJob runs
+    bool _isSnapshot = false; // copy being written by a SyncJob
+    bool _appendOnly = false; // snapshot holding only the pending changes
+    QString _syncError; // why the last write failed
+    Contents _contents; // published by contents()
+    QSet<QString> _outdatedFolders; // changed since it was
+    bool _contentsOutdated = true; // all of it is
 #ifdef HAVE_GPGMEPP
     GpgME::Key _gpgKey;
 #endif
+    friend class BackendPersistHandler;
     friend class BlowfishPersistHandler;
+    friend class AesGcmPersistHandler;
     friend class GpgPersistHandler;
 
     // open the wallet with the password already set. This is
     // called internally by both open and openPreHashed.
     int openInternal(WId w = 0);
+    int writeWallet(WId w);
+    int appendJournal();
+    int appendHeldOps();
+    int appendRecord(const QVector<Journal::Op> &ops, const QByteArray &payload);
+    void replayJournal(QFile &db, BackendPersistHandler *phandler, bool decrypted);
+    bool applyJournalRecord(const QByteArray &payload);
+    void holdOp(Journal::Operation op, const QString &folder, const QString &key, qint32 type, const QByteArray &value);
+    // Forgets the held changes to @p folder, or all of them.
+    void dropHeldOps(const QString &folder = QString());
+    bool decryptFolder(const QString &f);
+    bool decryptAllFolders();
     void swapToNewHash();
+    void markDirty()
+    {
+        ++_generation;
+    }
+    // A folder was written to, created or removed.
+    void folderChanged(const QString &f);
+    // A copy to be written by a SyncJob. It only holds the values of the
+    // pending changes if they can be appended to the journal, unless
+    // @p compact.
+    Backend *snapshot(bool compact);
+    void notifySyncFailed(int rc, const QString &error) const;
+    // The Blowfish key schedule of _passhash, expanded again only when the
+    // hash changed. Null if the key is rejected.
+    BlowFish *blowfish();
+    void releaseBlowfish();
     QByteArray createAndSaveSalt(const QString &path) const;
 };
 
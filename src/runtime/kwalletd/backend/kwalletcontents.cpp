@@ -0,0 +1,157 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletcontents.h"
+
+#include "kwalletentryindex.h"
+
+#include <QDataStream>
+#include <QMap>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+
+using namespace KWallet;
+
+struct Contents::Folder {
+    QVector<Item> items; // sorted by key
+    bool sealed;
+};
+
+struct Contents::Data {
+    QMap<QString, std::shared_ptr<const Folder>> folders;
+    quint64 generation;
+};
+
+Contents::Item::~Item()
+{
+    // the wallet may still be using the value
+    if (_value.isDetached()) {
+        _value.fill(0);
+    }
+}
+
+QByteArray Contents::Item::value() const
+{
+    return _payload ? _payload->valueAt(_offset) : _value;
+}
+
+QString Contents::Item::password() const
+{
+    QString x;
+    QDataStream qds(value());
+    qds >> x;
+    return x;
+}
+
+Contents::Contents()
+{
+}
+
+quint64 Contents::generation() const
+{
+    return d ? d->generation : 0;
+}
+
+const Contents::Folder *Contents::folder(const QString &name) const
+{
+    if (!d) {
+        return nullptr;
+    }
+    const auto i = d->folders.constFind(name);
+    return i == d->folders.constEnd() ? nullptr : i.value().get();
+}
+
+QStringList Contents::folderList() const
+{
+    return d ? d->folders.keys() : QStringList();
+}
+
+bool Contents::hasFolder(const QString &folder) const
+{
+    return this->folder(folder) != nullptr;
+}
+
+bool Contents::isSealed(const QString &folder) const
+{
+    const Folder *f = this->folder(folder);
+    return f && f->sealed;
+}
+
+QStringList Contents::entryList(const QString &folder) const
+{
+    QStringList keys;
+    const Folder *f = this->folder(folder);
+    if (f) {
+        keys.reserve(f->items.count());
+        for (const Item &item : f->items) {
+            keys.append(item._key);
+        }
+    }
+    return keys;
+}
+
+const Contents::Item *Contents::entry(const QString &folder, const QString &key) const
+{
+    const Folder *f = this->folder(folder);
+    if (!f) {
+        return nullptr;
+    }
+    const auto i = std::lower_bound(f->items.constBegin(), f->items.constEnd(), key, [](const Item &item, const QString &key) {
+        return item._key < key;
+    });
+    return i != f->items.constEnd() && i->_key == key ? &*i : nullptr;
+}
+
+Contents Contents::updated(const EntryIndex &entries, const QSet<QString> &sealed, const QSet<QString> &folders, quint64 generation) const
+{
+    std::shared_ptr<Data> data = std::make_shared<Data>();
+    if (d) {
+        data->folders = d->folders;
+    }
+    data->generation = generation;
+
+    for (const QString &name : folders) {
+        if (!entries.hasFolder(name)) {
+            data->folders.remove(name);
+            continue;
+        }
+
+        std::shared_ptr<Folder> f = std::make_shared<Folder>();
+        f->sealed = sealed.contains(name);
+        if (!f->sealed) {
+            const QVector<EntryIndex::Item> items = entries.items(name);
+            f->items.resize(items.count());
+            for (int i = 0; i < items.count(); ++i) {
+                const Entry *e = items.at(i).second;
+                Item &item = f->items[i];
+                item._key = items.at(i).first;
+                item._type = e->_type;
+                item._value = e->_value;
+                item._payload = e->_payload;
+                item._offset = e->_offset;
+            }
+        }
+        data->folders.insert(name, f);
+    }
+
+    Contents contents;
+    contents.d = data;
+    return contents;
+}
+
+Contents Contents::load(const Contents &published)
+{
+    Contents contents;
+    contents.d = std::atomic_load(&published.d);
+    return contents;
+}
+
+void Contents::store(Contents &published, const Contents &contents)
+{
+    std::atomic_store(&published.d, contents.d);
+}
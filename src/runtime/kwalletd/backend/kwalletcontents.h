@@ -0,0 +1,106 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETCONTENTS_H
+#define _KWALLETCONTENTS_H
+
+#include <QByteArray>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+#include <memory>
+
+#include "kwalletbackend5_export.h"
+#include "kwalletentry.h"
+
+namespace KWallet
+{
+class EntryIndex;
+
+/**
+ * @internal
+ * One version of the folders and entries of an open wallet. A version never
+ * changes once it has been made.
+ *
+ * Backend makes a new version when its contents are asked for after a
+ * change, sharing the folders which didn't change with the previous one,
+ * and publishes it with an atomic pointer swap. Copies are cheap and can be
+ * read on any thread, without locking, for as long as needed while the
+ * wallet goes on changing.
+ *
+ * The values the wallet hasn't decoded yet are decoded by value(), each
+ * time, and keep the decrypted wallet data they come from alive until the
+ * last version referencing them is gone. Folders which weren't decrypted
+ * when the version was made are sealed: their entries aren't known.
+ */
+class KWALLETBACKEND5_EXPORT Contents
+{
+public:
+    class Item
+    {
+    public:
+        ~Item();
+
+        const QString &key() const
+        {
+            return _key;
+        }
+        Wallet::EntryType type() const
+        {
+            return _type;
+        }
+        QByteArray value() const;
+        // As Entry::password().
+        QString password() const;
+
+    private:
+        friend class Contents;
+
+        QString _key;
+        Wallet::EntryType _type = Wallet::Unknown;
+        QByteArray _value;
+        QExplicitlySharedDataPointer<EntryPayload> _payload;
+        int _offset = 0;
+    };
+
+    // An empty version, as of a closed wallet.
+    Contents();
+
+    // The generation of the wallet this version was made at, see
+    // Backend::pendingChanges().
+    quint64 generation() const;
+
+    QStringList folderList() const;
+    bool hasFolder(const QString &folder) const;
+    bool isSealed(const QString &folder) const;
+
+    // Sorted keys of a folder.
+    QStringList entryList(const QString &folder) const;
+    // Returns null if there is no such entry. The item belongs to the
+    // version.
+    const Item *entry(const QString &folder, const QString &key) const;
+
+    // A version with @p folders updated from @p entries, the folders in
+    // @p sealed being sealed, and the others as they are in this one.
+    Contents updated(const EntryIndex &entries, const QSet<QString> &sealed, const QSet<QString> &folders, quint64 generation) const;
+
+    // For versions shared between threads.
+    static Contents load(const Contents &published);
+    static void store(Contents &published, const Contents &contents);
+
+private:
+    struct Folder;
+    struct Data;
+
+    const Folder *folder(const QString &name) const;
+
+    std::shared_ptr<const Data> d;
+};
+
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletdigestset.h"
+
+#include <QDataStream>
+#include <QVector>
+
+// digests read from a file at once, so a bogus count can't make us
+// allocate more than the file holds
+#define KWALLET_DIGEST_CHUNK 4096
+
+using namespace KWallet;
+
+static_assert(sizeof(MD5Digest) == 16, "digests are read and written as raw arrays");
+
+bool DigestSet::insert(const MD5Digest &digest)
+{
+    const int count = _digests.count();
+    _digests.insert(digest);
+    return _digests.count() != count;
+}
+
+bool DigestSet::read(QDataStream &stream, quint32 count)
+{
+    _digests.clear();
+    _digests.reserve(int(qMin<quint32>(count, KWALLET_DIGEST_CHUNK)));
+
+    QVector<MD5Digest> chunk;
+    while (count > 0) {
+        const int n = int(qMin<quint32>(count, KWALLET_DIGEST_CHUNK));
+        chunk.resize(n);
+        const int len = n * int(sizeof(MD5Digest));
+        if (stream.readRawData(reinterpret_cast<char *>(chunk.data()), len) != len) {
+            _digests.clear();
+            return false;
+        }
+        // older versions appended a digest each time an entry was written,
+        // the duplicates go away here
+        for (const MD5Digest &digest : qAsConst(chunk)) {
+            _digests.insert(digest);
+        }
+        count -= n;
+    }
+    return true;
+}
+
+void DigestSet::write(QDataStream &stream) const
+{
+    stream << static_cast<quint32>(_digests.count());
+    for (const MD5Digest &digest : _digests) {
+        stream.writeRawData(digest.constData(), int(sizeof(MD5Digest)));
+    }
+}
+
+int DigestTable::read(QDataStream &stream)
+{
+    clear();
+    quint32 n;
+    stream >> n;
+    if (stream.status() != QDataStream::Ok || n > 0xffff) { // sanity check
+        return -43;
+    }
+
+    for (quint32 i = 0; i < n; ++i) {
+        char folder[16];
+        quint32 count;
+        if (stream.atEnd()) {
+            return -43;
+        }
+        stream.readRawData(folder, 16);
+        stream >> count;
+        if (!(*this)[MD5Digest(folder)].read(stream, count)) {
+            return -43;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETDIGESTSET_H
+#define _KWALLETDIGESTSET_H
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+#include <string.h>
+
+#include "kwalletbackend5_export.h"
+
+class QDataStream;
+
+namespace KWallet
+{
+/**
+ * @internal
+ * The MD5 digest of a folder name or of a key, as stored in the cleartext
+ * digest table of the wallet files.
+ */
+class MD5Digest
+{
+public:
+    MD5Digest()
+    {
+        memset(_data, 0, sizeof(_data));
+    }
+    explicit MD5Digest(const char *data)
+    {
+        memcpy(_data, data, sizeof(_data));
+    }
+    MD5Digest(const QByteArray &digest)
+    {
+        Q_ASSERT(digest.size() == int(sizeof(_data)));
+        memcpy(_data, digest.constData(), sizeof(_data));
+    }
+
+    // The digest of a folder name or a key.
+    static MD5Digest of(const QString &name)
+    {
+        return MD5Digest(QCryptographicHash::hash(name.toUtf8(), QCryptographicHash::Md5));
+    }
+
+    const char *constData() const
+    {
+        return _data;
+    }
+
+    bool operator==(const MD5Digest &r) const
+    {
+        return memcmp(_data, r._data, sizeof(_data)) == 0;
+    }
+    bool operator!=(const MD5Digest &r) const
+    {
+        return !operator==(r);
+    }
+    bool operator<(const MD5Digest &r) const
+    {
+        return memcmp(_data, r._data, sizeof(_data)) < 0;
+    }
+
+private:
+    char _data[16];
+};
+
+inline uint qHash(const MD5Digest &digest, uint seed = 0)
+{
+    // the bytes of a digest are as good as any hash of them
+    uint h;
+    memcpy(&h, digest.constData(), sizeof(h));
+    return h ^ seed;
+}
+
+/**
+ * @internal
+ * The key digests of a folder.
+ *
+ * The digests are kept in a hashed set, so looking one up, adding or
+ * removing it costs the same however many keys the folder has. The set is
+ * in no particular order.
+ */
+class KWALLETBACKEND5_EXPORT DigestSet
+{
+public:
+    typedef QSet<MD5Digest>::const_iterator const_iterator;
+
+    int count() const
+    {
+        return _digests.count();
+    }
+    bool isEmpty() const
+    {
+        return _digests.isEmpty();
+    }
+    const_iterator begin() const
+    {
+        return _digests.constBegin();
+    }
+    const_iterator end() const
+    {
+        return _digests.constEnd();
+    }
+
+    bool contains(const MD5Digest &digest) const
+    {
+        return _digests.contains(digest);
+    }
+    // Returns false if the digest is in the set already.
+    bool insert(const MD5Digest &digest);
+    // Returns false if the digest isn't in the set.
+    bool remove(const MD5Digest &digest)
+    {
+        return _digests.remove(digest);
+    }
+    void clear()
+    {
+        _digests.clear();
+    }
+
+    // Replaces the set with the @p count digests following in @p stream.
+    // Returns false if the stream ends before.
+    bool read(QDataStream &stream, quint32 count);
+    // Writes the number of digests followed by the digests.
+    void write(QDataStream &stream) const;
+
+private:
+    QSet<MD5Digest> _digests;
+};
+
+/**
+ * @internal
+ * The cleartext digest table of a wallet file: the key digests of each
+ * folder, by folder digest.
+ */
+class DigestTable : public QHash<MD5Digest, DigestSet>
+{
+public:
+    // Replaces the table with the one following in @p stream. Returns a
+    // negative value if it is malformed.
+    int read(QDataStream &stream);
+
+    bool folderDoesNotExist(const MD5Digest &folder) const
+    {
+        return !contains(folder);
+    }
+    bool entryDoesNotExist(const MD5Digest &folder, const MD5Digest &key) const
+    {
+        const_iterator i = find(folder);
+        return i == constEnd() || !i.value().contains(key);
+    }
+};
+
+}
+
+#endif
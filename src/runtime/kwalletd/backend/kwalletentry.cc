@@ -10,6 +10,7 @@
 using namespace KWallet;
 #include <QDataStream>
 #include <QIODevice>
+#include <QtEndian>
 
 Entry::Entry()
 {
@@ -27,13 +28,34 @@ const QString &Entry::key() const
 
 const QByteArray &Entry::value() const
 {
+    if (_payload) {
+        decodeValue();
+    }
     return _value;
 }
 
+void Entry::decodeValue() const
+{
+    _value = _payload->valueAt(_offset);
+    _payload.reset();
+}
+
+QByteArray EntryPayload::valueAt(int offset) const
+{
+    // same as QDataStream >> QByteArray, without the stream
+    if (offset >= 0 && offset <= data.size() - 4) {
+        const quint32 size = qFromBigEndian<quint32>(data.constData() + offset);
+        if (size != 0xffffffff && size <= quint32(data.size() - offset - 4)) {
+            return QByteArray(data.constData() + offset + 4, size);
+        }
+    }
+    return QByteArray();
+}
+
 QString Entry::password() const
 {
     QString x;
-    QDataStream qds(_value);
+    QDataStream qds(value());
     qds >> x;
     return x;
 }
@@ -42,12 +64,14 @@ void Entry::setValue(const QByteArray &val)
 {
     // do a direct copy from one into the other without
     // temporary variables
+    _payload.reset();
     _value.fill(0);
     _value = val;
 }
 
 void Entry::setValue(const QString &val)
 {
+    _payload.reset();
     _value.fill(0);
     QDataStream qds(&_value, QIODevice::WriteOnly);
     qds << val;
@@ -68,10 +92,20 @@ void Entry::setType(Wallet::EntryType type)
     _type = type;
 }
 
+void Entry::setValue(const QExplicitlySharedDataPointer<EntryPayload> &payload, int offset)
+{
+    _value.fill(0);
+    _value = QByteArray();
+    _payload = payload;
+    _offset = offset;
+}
+
 void Entry::copy(const Entry *x)
 {
     _type = x->_type;
     _key = x->_key;
+    _payload = x->_payload;
+    _offset = x->_offset;
     _value.fill(0);
     _value = x->_value;
 }
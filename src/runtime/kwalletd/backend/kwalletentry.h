@@ -8,6 +8,8 @@
 #ifndef _KWALLETENTRY_H
 #define _KWALLETENTRY_H
 
+#include <QExplicitlySharedDataPointer>
+#include <QSharedData>
 #include <QString>
 
 #include <kwallet.h>
@@ -16,6 +18,27 @@
 
 namespace KWallet
 {
+/* @internal
+ * Decrypted wallet contents still referenced by entries whose value hasn't
+ * been decoded yet. Wiped when the last of them lets go of it.
+ */
+class KWALLETBACKEND5_EXPORT EntryPayload : public QSharedData
+{
+public:
+    EntryPayload()
+    {
+    }
+    ~EntryPayload()
+    {
+        data.fill(0);
+    }
+
+    // The QDataStream serialized byte array at @p offset.
+    QByteArray valueAt(int offset) const;
+
+    QByteArray data;
+};
+
 /* @internal
  */
 class KWALLETBACKEND5_EXPORT Entry
@@ -34,6 +57,9 @@ public:
 
     void setValue(const QByteArray &val);
     void setValue(const QString &val);
+    // The value is the QDataStream serialized byte array at offset in
+    // payload. It's only decoded once value() is called.
+    void setValue(const QExplicitlySharedDataPointer<EntryPayload> &payload, int offset);
     void setKey(const QString &key);
 
     Wallet::EntryType type() const;
@@ -42,9 +68,15 @@ public:
     void copy(const Entry *x);
 
 private:
+    friend class Contents;
+
+    void decodeValue() const;
+
     QString _key;
-    QByteArray _value;
+    mutable QByteArray _value;
     Wallet::EntryType _type;
+    mutable QExplicitlySharedDataPointer<EntryPayload> _payload;
+    int _offset = 0;
 };
 
 }
@@ -0,0 +1,93 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletentryarena.h"
+#include "kwalletentry.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+// Entries allocated at once
+#define KWALLET_ARENA_BLOCK_ENTRIES 64
+
+using namespace KWallet;
+
+struct EntryArena::Slot {
+    alignas(Entry) char storage[sizeof(Entry)];
+    Slot *next; // next free slot
+    bool live;
+};
+
+struct EntryArena::Block {
+    Slot slots[KWALLET_ARENA_BLOCK_ENTRIES];
+};
+
+EntryArena::EntryArena()
+    : _free(nullptr)
+{
+}
+
+EntryArena::~EntryArena()
+{
+    clear();
+}
+
+void EntryArena::grow()
+{
+    Block *block = static_cast<Block *>(malloc(sizeof(Block)));
+    Q_CHECK_PTR(block);
+
+    for (int i = KWALLET_ARENA_BLOCK_ENTRIES - 1; i >= 0; --i) {
+        block->slots[i].live = false;
+        block->slots[i].next = _free;
+        _free = &block->slots[i];
+    }
+    _blocks.append(block);
+}
+
+Entry *EntryArena::create()
+{
+    if (!_free) {
+        grow();
+    }
+
+    Slot *slot = _free;
+    _free = slot->next;
+    slot->live = true;
+    return new (slot->storage) Entry;
+}
+
+void EntryArena::destroy(Entry *entry)
+{
+    if (!entry) {
+        return;
+    }
+
+    entry->~Entry();
+    // storage is the first member of the slot
+    Slot *slot = reinterpret_cast<Slot *>(entry);
+    memset(slot->storage, 0, sizeof(slot->storage));
+    slot->live = false;
+    slot->next = _free;
+    _free = slot;
+}
+
+void EntryArena::clear()
+{
+    for (Block *block : qAsConst(_blocks)) {
+        for (Slot &slot : block->slots) {
+            if (slot.live) {
+                reinterpret_cast<Entry *>(slot.storage)->~Entry();
+            }
+        }
+
+        memset(block, 0, sizeof(Block));
+        free(block);
+    }
+    _blocks.clear();
+    _free = nullptr;
+}
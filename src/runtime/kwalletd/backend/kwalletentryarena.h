@@ -0,0 +1,55 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETENTRYARENA_H
+#define _KWALLETENTRYARENA_H
+
+#include <QVector>
+
+#include "kwalletbackend5_export.h"
+
+namespace KWallet
+{
+class Entry;
+
+/**
+ * @internal
+ * Storage for the entries of an open wallet.
+ *
+ * Entries are carved out of blocks of the regular heap, a few dozen at a
+ * time, rather than allocated one by one. Freed entries are reused. clear()
+ * destroys the remaining entries, then wipes and releases the blocks.
+ *
+ * Only the entries themselves live in the blocks. Their keys and values
+ * are allocated by QString and QByteArray; Entry wipes the values.
+ */
+class KWALLETBACKEND5_EXPORT EntryArena
+{
+public:
+    EntryArena();
+    ~EntryArena();
+
+    Entry *create();
+    // Accepts null.
+    void destroy(Entry *entry);
+
+    void clear();
+
+private:
+    Q_DISABLE_COPY(EntryArena)
+
+    struct Slot;
+    struct Block;
+
+    void grow();
+
+    QVector<Block *> _blocks;
+    Slot *_free;
+};
+
+}
+
+#endif
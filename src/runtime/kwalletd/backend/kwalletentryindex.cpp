@@ -0,0 +1,371 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletentryindex.h"
+
+#include <QHash>
+
+#include <algorithm>
+
+#define KWALLET_INDEX_MIN_SLOTS 16
+
+using namespace KWallet;
+
+// Returns the slot holding an item matching @p match, or the empty slot
+// where it would go.
+template<typename T, typename Match>
+static int probe(const QVector<int> &slots, const QVector<T> &items, uint hash, Match match)
+{
+    const int mask = slots.size() - 1;
+    for (int s = hash & mask;; s = (s + 1) & mask) {
+        const int i = slots.at(s);
+        if (i < 0 || (items.at(i).hash == hash && match(items.at(i)))) {
+            return s;
+        }
+    }
+}
+
+template<typename T>
+static const MD5Digest &digestOf(const T &item, const QString &name)
+{
+    if (!item.digested) {
+        item.digest = MD5Digest::of(name);
+        item.digested = true;
+    }
+    return item.digest;
+}
+
+// Returns the slot holding item @p index.
+static int slotOf(const QVector<int> &slots, uint hash, int index)
+{
+    const int mask = slots.size() - 1;
+    int s = hash & mask;
+    while (slots.at(s) != index) {
+        s = (s + 1) & mask;
+    }
+    return s;
+}
+
+// Empties slot @p s, moving back the items after it which would no longer
+// be found otherwise.
+template<typename T>
+static void eraseSlot(QVector<int> &slots, const QVector<T> &items, int s)
+{
+    const int mask = slots.size() - 1;
+    int hole = s;
+    for (int j = (s + 1) & mask; slots.at(j) >= 0; j = (j + 1) & mask) {
+        const int home = items.at(slots.at(j)).hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            slots[hole] = slots.at(j);
+            hole = j;
+        }
+    }
+    slots[hole] = -1;
+}
+
+template<typename T>
+static void rehash(QVector<int> &slots, const QVector<T> &items, int size)
+{
+    const int mask = size - 1;
+    slots.fill(-1, size);
+    for (int i = 0; i < items.count(); ++i) {
+        int s = items.at(i).hash & mask;
+        while (slots.at(s) >= 0) {
+            s = (s + 1) & mask;
+        }
+        slots[s] = i;
+    }
+}
+
+// Makes room for one more item.
+template<typename T>
+static bool reserveSlot(QVector<int> &slots, const QVector<T> &items)
+{
+    if ((items.count() + 1) * 2 <= slots.size()) {
+        return false;
+    }
+    rehash(slots, items, slots.size() * 2);
+    return true;
+}
+
+EntryIndex::EntryIndex()
+    : _folderSlots(KWALLET_INDEX_MIN_SLOTS, -1)
+    , _recordSlots(KWALLET_INDEX_MIN_SLOTS, -1)
+{
+}
+
+int EntryIndex::folderIndex(const QString &folder) const
+{
+    const uint hash = qHash(folder);
+    return _folderSlots.at(probe(_folderSlots, _folders, hash, [&folder](const Folder &f) {
+        return f.name == folder;
+    }));
+}
+
+int EntryIndex::recordSlot(int folder, const QString &key, uint hash) const
+{
+    return probe(_recordSlots, _records, hash, [folder, &key](const Record &r) {
+        return r.folder == folder && r.key == key;
+    });
+}
+
+bool EntryIndex::hasFolder(const QString &folder) const
+{
+    return folderIndex(folder) >= 0;
+}
+
+bool EntryIndex::insertFolder(const QString &folder)
+{
+    if (folderIndex(folder) >= 0) {
+        return false;
+    }
+
+    reserveSlot(_folderSlots, _folders);
+    const Folder f = {folder, qHash(folder), -1, 0, MD5Digest(), false};
+    _folders.append(f);
+    _folderSlots[slotOf(_folderSlots, f.hash, -1)] = _folders.count() - 1;
+    return true;
+}
+
+QList<Entry *> EntryIndex::takeFolder(const QString &folder)
+{
+    QList<Entry *> entries;
+    const int f = folderIndex(folder);
+    if (f < 0) {
+        return entries;
+    }
+
+    while (_folders.at(f).first >= 0) {
+        const int i = _folders.at(f).first;
+        entries.append(_records.at(i).entry);
+        eraseSlot(_recordSlots, _records, slotOf(_recordSlots, _records.at(i).hash, i));
+        unlink(i);
+        removeRecord(i);
+    }
+
+    eraseSlot(_folderSlots, _folders, slotOf(_folderSlots, _folders.at(f).hash, f));
+    const int last = _folders.count() - 1;
+    if (f != last) {
+        _folders[f] = _folders.at(last);
+        _folderSlots[slotOf(_folderSlots, _folders.at(f).hash, last)] = f;
+        for (int i = _folders.at(f).first; i >= 0; i = _records.at(i).next) {
+            _records[i].folder = f;
+        }
+    }
+    _folders.removeLast();
+    return entries;
+}
+
+QStringList EntryIndex::folderList() const
+{
+    QStringList folders;
+    folders.reserve(_folders.count());
+    for (const Folder &f : _folders) {
+        folders.append(f.name);
+    }
+    std::sort(folders.begin(), folders.end());
+    return folders;
+}
+
+int EntryIndex::entryCount(const QString &folder) const
+{
+    const int f = folderIndex(folder);
+    return f < 0 ? 0 : _folders.at(f).count;
+}
+
+Entry *EntryIndex::value(const QString &folder, const QString &key) const
+{
+    const int f = folderIndex(folder);
+    if (f < 0) {
+        return nullptr;
+    }
+    const int i = _recordSlots.at(recordSlot(f, key, qHash(key, _folders.at(f).hash)));
+    return i < 0 ? nullptr : _records.at(i).entry;
+}
+
+Entry *EntryIndex::insert(const QString &folder, const QString &key, Entry *entry)
+{
+    int f = folderIndex(folder);
+    if (f < 0) {
+        insertFolder(folder);
+        f = _folders.count() - 1;
+    }
+
+    const uint hash = qHash(key, _folders.at(f).hash);
+    int s = recordSlot(f, key, hash);
+    const int i = _recordSlots.at(s);
+    if (i >= 0) {
+        Entry *old = _records.at(i).entry;
+        _records[i].entry = entry;
+        return old;
+    }
+
+    if (reserveSlot(_recordSlots, _records)) {
+        s = recordSlot(f, key, hash);
+    }
+
+    Folder &fo = _folders[f];
+    const Record r = {key, hash, f, -1, fo.first, entry, MD5Digest(), false};
+    const int n = _records.count();
+    if (fo.first >= 0) {
+        _records[fo.first].prev = n;
+    }
+    fo.first = n;
+    ++fo.count;
+    _records.append(r);
+    _recordSlots[s] = n;
+    return nullptr;
+}
+
+Entry *EntryIndex::take(const QString &folder, const QString &key)
+{
+    const int f = folderIndex(folder);
+    if (f < 0) {
+        return nullptr;
+    }
+
+    const int s = recordSlot(f, key, qHash(key, _folders.at(f).hash));
+    const int i = _recordSlots.at(s);
+    if (i < 0) {
+        return nullptr;
+    }
+
+    Entry *entry = _records.at(i).entry;
+    eraseSlot(_recordSlots, _records, s);
+    unlink(i);
+    removeRecord(i);
+    return entry;
+}
+
+void EntryIndex::unlink(int record)
+{
+    const Record &r = _records.at(record);
+    if (r.prev >= 0) {
+        _records[r.prev].next = r.next;
+    } else {
+        _folders[r.folder].first = r.next;
+    }
+    if (r.next >= 0) {
+        _records[r.next].prev = r.prev;
+    }
+    --_folders[r.folder].count;
+}
+
+// Fills the gap left by @p record, which is no longer in the hash table,
+// with the last entry.
+void EntryIndex::removeRecord(int record)
+{
+    const int last = _records.count() - 1;
+    if (record != last) {
+        _records[record] = _records.at(last);
+        const Record &r = _records.at(record);
+        _recordSlots[slotOf(_recordSlots, r.hash, last)] = record;
+        if (r.prev >= 0) {
+            _records[r.prev].next = record;
+        } else {
+            _folders[r.folder].first = record;
+        }
+        if (r.next >= 0) {
+            _records[r.next].prev = record;
+        }
+    }
+    _records.removeLast();
+}
+
+QVector<EntryIndex::Item> EntryIndex::items(const QString &folder) const
+{
+    QVector<Item> items;
+    const int f = folderIndex(folder);
+    if (f < 0) {
+        return items;
+    }
+
+    items.reserve(_folders.at(f).count);
+    for (int i = _folders.at(f).first; i >= 0; i = _records.at(i).next) {
+        items.append(qMakePair(_records.at(i).key, _records.at(i).entry));
+    }
+    std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+        return a.first < b.first;
+    });
+    return items;
+}
+
+QStringList EntryIndex::keys(const QString &folder) const
+{
+    QStringList keys;
+    const QVector<Item> all = items(folder);
+    keys.reserve(all.count());
+    for (const Item &item : all) {
+        keys.append(item.first);
+    }
+    return keys;
+}
+
+QList<Entry *> EntryIndex::values(const QString &folder) const
+{
+    QList<Entry *> values;
+    const QVector<Item> all = items(folder);
+    values.reserve(all.count());
+    for (const Item &item : all) {
+        values.append(item.second);
+    }
+    return values;
+}
+
+QList<Entry *> EntryIndex::takeAll()
+{
+    QList<Entry *> entries;
+    entries.reserve(_records.count());
+    for (const Record &r : qAsConst(_records)) {
+        entries.append(r.entry);
+    }
+    _folders.clear();
+    _records.clear();
+    _folderSlots.fill(-1, KWALLET_INDEX_MIN_SLOTS);
+    _recordSlots.fill(-1, KWALLET_INDEX_MIN_SLOTS);
+    return entries;
+}
+
+MD5Digest EntryIndex::folderDigest(const QString &folder) const
+{
+    const int f = folderIndex(folder);
+    return f < 0 ? MD5Digest::of(folder) : digestOf(_folders.at(f), folder);
+}
+
+MD5Digest EntryIndex::keyDigest(const QString &folder, const QString &key) const
+{
+    const int f = folderIndex(folder);
+    if (f < 0) {
+        return MD5Digest::of(key);
+    }
+    const int i = _recordSlots.at(recordSlot(f, key, qHash(key, _folders.at(f).hash)));
+    return i < 0 ? MD5Digest::of(key) : digestOf(_records.at(i), key);
+}
+
+QVector<MD5Digest> EntryIndex::keyDigests(const QString &folder) const
+{
+    QVector<MD5Digest> digests;
+    const int f = folderIndex(folder);
+    if (f < 0) {
+        return digests;
+    }
+
+    digests.reserve(_folders.at(f).count);
+    for (int i = _folders.at(f).first; i >= 0; i = _records.at(i).next) {
+        digests.append(digestOf(_records.at(i), _records.at(i).key));
+    }
+    return digests;
+}
+
+void EntryIndex::computeDigests() const
+{
+    for (const Folder &f : _folders) {
+        digestOf(f, f.name);
+    }
+    for (const Record &r : _records) {
+        digestOf(r, r.key);
+    }
+}
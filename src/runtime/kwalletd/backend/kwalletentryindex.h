@@ -0,0 +1,134 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETENTRYINDEX_H
+#define _KWALLETENTRYINDEX_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "kwalletbackend5_export.h"
+#include "kwalletdigestset.h"
+
+namespace KWallet
+{
+class Entry;
+
+/**
+ * @internal
+ * The folders and entries of an open wallet.
+ *
+ * Folders and entries are kept in two flat arrays, each with an open
+ * addressing hash table (linear probing, no tombstones) on top. Entries are
+ * looked up by (folder, key), with the hash of the folder name used as the
+ * seed of the hash of the key, so a lookup is two probes of small integer
+ * arrays. The entries of a folder are chained together so listing a folder
+ * doesn't scan the whole wallet. Nothing is kept sorted: the lists are
+ * sorted when they are built.
+ *
+ * The index doesn't own the entries, it hands them back when they are
+ * replaced or removed.
+ */
+class KWALLETBACKEND5_EXPORT EntryIndex
+{
+public:
+    typedef QPair<QString, Entry *> Item;
+
+    EntryIndex();
+
+    int folderCount() const
+    {
+        return _folders.count();
+    }
+    int count() const
+    {
+        return _records.count();
+    }
+
+    bool hasFolder(const QString &folder) const;
+    // Returns false if the folder already exists.
+    bool insertFolder(const QString &folder);
+    // Removes the folder and returns its entries.
+    QList<Entry *> takeFolder(const QString &folder);
+    // Sorted list of the folders.
+    QStringList folderList() const;
+
+    int entryCount(const QString &folder) const;
+    // Returns null if there is no such entry.
+    Entry *value(const QString &folder, const QString &key) const;
+    // Stores @p entry under @p key, creating the folder if needed. Returns
+    // the entry it replaces, if any.
+    Entry *insert(const QString &folder, const QString &key, Entry *entry);
+    // Removes the entry and returns it, or null if there is no such entry.
+    Entry *take(const QString &folder, const QString &key);
+
+    // Keys and entries of a folder, sorted by key.
+    QVector<Item> items(const QString &folder) const;
+    QStringList keys(const QString &folder) const;
+    QList<Entry *> values(const QString &folder) const;
+
+    // Empties the index and returns all the entries.
+    QList<Entry *> takeAll();
+
+    // Replaces each entry with what @p f returns for it, e.g. a copy.
+    template<typename F>
+    void transform(F f)
+    {
+        for (Record &r : _records) {
+            r.entry = f(r.entry);
+        }
+    }
+
+    // MD5 digests of the names, as in the digest table of the wallet file.
+    // They are computed when first needed and kept until the folder or
+    // entry is removed.
+    MD5Digest folderDigest(const QString &folder) const;
+    MD5Digest keyDigest(const QString &folder, const QString &key) const;
+    // The digests of the keys of a folder, in no particular order.
+    QVector<MD5Digest> keyDigests(const QString &folder) const;
+    // Computes all the digests not known yet.
+    void computeDigests() const;
+
+private:
+    struct Folder {
+        QString name;
+        uint hash;
+        int first; // first entry of the folder, or -1
+        int count;
+        mutable MD5Digest digest;
+        mutable bool digested;
+    };
+
+    struct Record {
+        QString key;
+        uint hash;
+        int folder;
+        int prev; // entries of the same folder, or -1
+        int next;
+        Entry *entry;
+        mutable MD5Digest digest;
+        mutable bool digested;
+    };
+
+    int folderIndex(const QString &folder) const;
+    int recordSlot(int folder, const QString &key, uint hash) const;
+    void unlink(int record);
+    void removeRecord(int record);
+
+    QVector<Folder> _folders;
+    QVector<Record> _records;
+    // Indexes in the arrays above, or -1. The size is a power of two and
+    // at least twice the number of items.
+    QVector<int> _folderSlots;
+    QVector<int> _recordSlots;
+};
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletindex.h"
+
+#include "backendpersisthandler.h"
+#include "kwalletbackend.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+#include <limits.h>
+
+#ifdef Q_OS_UNIX
+#include <qplatformdefs.h>
+#endif
+
+using namespace KWallet;
+
+WalletIndex::WalletIndex(const QString &name, bool isPath)
+    : _stamp{-1, 0, 0}
+    , _valid(false)
+{
+    if (isPath) {
+        _path = name;
+    } else if (!name.isEmpty()) {
+        _path = Backend::getSaveLocation() + QDir::separator() + name + ".kwl";
+    }
+}
+
+WalletIndex::Stamp WalletIndex::stampOf(const QString &path)
+{
+    Stamp stamp = {-1, 0, 0};
+    const QFileInfo info(path);
+    if (!info.exists()) {
+        return stamp;
+    }
+
+    stamp.size = info.size();
+    stamp.modified = info.lastModified().toMSecsSinceEpoch();
+#ifdef Q_OS_UNIX
+    // a rewritten wallet is a new file
+    QT_STATBUF st;
+    if (QT_STAT(QFile::encodeName(path).constData(), &st) == 0) {
+        stamp.inode = st.st_ino;
+    }
+#endif
+    return stamp;
+}
+
+bool WalletIndex::update()
+{
+    const Stamp stamp = stampOf(_path);
+    if (stamp.size < 0) {
+        _stamp = stamp;
+        _valid = false;
+        _hashes.clear();
+        return false;
+    }
+    if (stamp != _stamp) {
+        // Should the file change while it is read, the stamp taken before
+        // makes the next call read it again.
+        _valid = read() == 0;
+        _stamp = stamp;
+    }
+    return _valid;
+}
+
+int WalletIndex::read()
+{
+    QFile db(_path);
+    if (!db.open(QIODevice::ReadOnly)) {
+        _hashes.clear();
+        return -2;
+    }
+
+    // Only the beginning of the file and the headers of the journal records
+    // are looked at, the encrypted data in between isn't even paged in.
+    const qint64 size = db.size();
+    uchar *map = size > 0 && size < INT_MAX ? db.map(0, size) : nullptr;
+    int rc;
+    if (map) {
+        QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(map), int(size));
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+        rc = BackendPersistHandler::readIndex(&buffer, _hashes);
+        db.unmap(map);
+    } else {
+        rc = BackendPersistHandler::readIndex(&db, _hashes);
+    }
+
+    if (rc < 0) {
+        _hashes.clear();
+    }
+    return rc;
+}
+
+bool WalletIndex::folderDoesNotExist(const QString &folder) const
+{
+    return _hashes.folderDoesNotExist(MD5Digest::of(folder));
+}
+
+bool WalletIndex::entryDoesNotExist(const QString &folder, const QString &entry) const
+{
+    return _hashes.entryDoesNotExist(MD5Digest::of(folder), MD5Digest::of(entry));
+}
@@ -0,0 +1,67 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETINDEX_H
+#define _KWALLETINDEX_H
+
+#include <QString>
+
+#include "kwalletbackend5_export.h"
+#include "kwalletdigestset.h"
+
+namespace KWallet
+{
+/**
+ * @internal
+ * Answers Backend::folderDoesNotExist() and entryDoesNotExist() for a
+ * wallet which isn't open, from the cleartext digest table of its file.
+ *
+ * Only the header, the digest table and the cleartext part of the journal
+ * records are read, from a memory mapping of the file when possible, and
+ * nothing is decrypted. The table is kept until the size, modification time
+ * or inode of the file change. Wallets whose digests are encrypted (GPG) or
+ * whose file can't be read can't be answered for this way.
+ */
+class KWALLETBACKEND5_EXPORT WalletIndex
+{
+public:
+    explicit WalletIndex(const QString &name = QString(), bool isPath = false);
+
+    // Reads the table again if the file changed. Returns false if the
+    // questions have to go to the Backend.
+    bool update();
+
+    bool folderDoesNotExist(const QString &folder) const;
+    bool entryDoesNotExist(const QString &folder, const QString &entry) const;
+
+private:
+    struct Stamp {
+        qint64 size;
+        qint64 modified;
+        quint64 inode;
+
+        bool operator==(const Stamp &o) const
+        {
+            return size == o.size && modified == o.modified && inode == o.inode;
+        }
+        bool operator!=(const Stamp &o) const
+        {
+            return !operator==(o);
+        }
+    };
+
+    static Stamp stampOf(const QString &path);
+    int read();
+
+    QString _path;
+    Stamp _stamp;
+    bool _valid;
+    DigestTable _hashes;
+};
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletjournal.h"
+
+#include <QDataStream>
+#include <QIODevice>
+
+#define KWALLET_JOURNAL_RECORD_MAGIC 0x4b574a52 // "KWJR"
+
+// Below this size the journal is never worth folding into the base image
+#define KWALLET_JOURNAL_COMPACT_SIZE (64 * 1024)
+#define KWALLET_JOURNAL_COMPACT_RECORDS 1024
+// Past this many operations a single record isn't cheaper than a rewrite
+#define KWALLET_JOURNAL_MAX_PENDING 4096
+// Appending stops at this multiple of the compaction threshold, in case
+// nobody compacts the wallet
+#define KWALLET_JOURNAL_HARD_LIMIT 4
+
+using namespace KWallet;
+
+Journal::Journal()
+    : _base(0)
+    , _size(0)
+    , _records(0)
+    , _valid(false)
+    , _recording(true)
+{
+}
+
+void Journal::reset()
+{
+    _pending.clear();
+    _base = 0;
+    _size = 0;
+    _records = 0;
+    _valid = false;
+}
+
+void Journal::setBase(qint64 offset)
+{
+    _pending.clear();
+    _base = offset;
+    _size = 0;
+    _records = 0;
+    _valid = true;
+}
+
+void Journal::record(Operation op, const QString &folder, const MD5Digest &folderDigest, const QString &key, const MD5Digest &keyDigest)
+{
+    // nothing to track if the next sync rewrites the wallet anyway
+    if (!_valid || !_recording) {
+        return;
+    }
+
+    const Op o = {op, folder, key, folderDigest, keyDigest};
+    if (!_pending.isEmpty() && _pending.last() == o) {
+        return;
+    }
+
+    if (_pending.count() >= KWALLET_JOURNAL_MAX_PENDING) {
+        _pending.clear();
+        _valid = false;
+        return;
+    }
+    _pending.append(o);
+}
+
+void Journal::committed(qint64 size)
+{
+    _pending.clear();
+    _size += size;
+    ++_records;
+}
+
+static qint64 compactionThreshold(qint64 base)
+{
+    return qMax<qint64>(KWALLET_JOURNAL_COMPACT_SIZE, base / 2);
+}
+
+bool Journal::isCompactionDue() const
+{
+    return _valid && (_size > compactionThreshold(_base) || _records >= KWALLET_JOURNAL_COMPACT_RECORDS);
+}
+
+bool Journal::canAppend() const
+{
+    return _valid && _base > 0 && _size < KWALLET_JOURNAL_HARD_LIMIT * compactionThreshold(_base)
+        && _records < KWALLET_JOURNAL_HARD_LIMIT * KWALLET_JOURNAL_COMPACT_RECORDS;
+}
+
+QByteArray Journal::frame(const QVector<Op> &ops, const QByteArray &sealed)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    // folder operations come with the digest of an empty key
+    static const MD5Digest noKey = MD5Digest::of(QString());
+
+    stream << static_cast<quint32>(KWALLET_JOURNAL_RECORD_MAGIC);
+    stream << static_cast<quint32>(ops.count());
+    for (const Op &op : ops) {
+        const bool folderOp = op.op == CreateFolder || op.op == RemoveFolder;
+        stream << static_cast<quint8>(op.op);
+        stream.writeRawData(op.folderDigest.constData(), 16);
+        stream.writeRawData(folderOp ? noKey.constData() : op.keyDigest.constData(), 16);
+    }
+
+    stream << static_cast<quint32>(sealed.size());
+    stream.writeRawData(sealed.constData(), sealed.size());
+    return record;
+}
+
+bool Journal::readRecord(QIODevice *dev, QVector<DigestOp> &ops, QByteArray &sealed)
+{
+    QDataStream stream(dev);
+    quint32 magic = 0;
+    quint32 count = 0;
+
+    stream >> magic >> count;
+    if (stream.status() != QDataStream::Ok || magic != KWALLET_JOURNAL_RECORD_MAGIC || count > KWALLET_JOURNAL_MAX_PENDING) {
+        return false;
+    }
+
+    ops.clear();
+    ops.reserve(count);
+    for (quint32 i = 0; i < count; ++i) {
+        quint8 op = 0;
+        DigestOp d;
+        d.folder.resize(16);
+        d.key.resize(16);
+
+        stream >> op;
+        if (stream.readRawData(d.folder.data(), 16) != 16 || stream.readRawData(d.key.data(), 16) != 16) {
+            return false;
+        }
+        if (op < WriteEntry || op > RemoveFolder) {
+            return false;
+        }
+        d.op = static_cast<Operation>(op);
+        ops.append(d);
+    }
+
+    quint32 size = 0;
+    stream >> size;
+    if (stream.status() != QDataStream::Ok || size > dev->bytesAvailable()) {
+        return false;
+    }
+
+    sealed.resize(size);
+    return stream.readRawData(sealed.data(), size) == static_cast<int>(size);
+}
+
+void Journal::applyDigests(DigestTable &table, const QVector<DigestOp> &ops)
+{
+    for (const DigestOp &op : ops) {
+        const MD5Digest folder(op.folder);
+        switch (op.op) {
+        case WriteEntry:
+            table[folder].insert(MD5Digest(op.key));
+            break;
+        case RemoveEntry: {
+            DigestTable::iterator i = table.find(folder);
+            if (i != table.end()) {
+                i.value().remove(MD5Digest(op.key));
+            }
+            break;
+        }
+        case CreateFolder:
+            if (!table.contains(folder)) {
+                table.insert(folder, DigestSet());
+            }
+            break;
+        case RemoveFolder:
+            table.remove(folder);
+            break;
+        }
+    }
+}
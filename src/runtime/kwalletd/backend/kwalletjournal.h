@@ -0,0 +1,147 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETJOURNAL_H
+#define _KWALLETJOURNAL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include "kwalletdigestset.h"
+
+class QIODevice;
+
+namespace KWallet
+{
+/**
+ * @internal
+ * Bookkeeping for the delta records Backend::sync() appends to journaled
+ * wallet files instead of rewriting them.
+ *
+ * A journaled wallet is a base image (header, digest table and encrypted
+ * contents, split in per-folder segments) followed by any number of
+ * records. Each record carries the folder/key digests it touches in clear,
+ * so the digest table of a closed wallet stays accurate, and the operations
+ * themselves in a block sealed by the persist handler.
+ */
+class Journal
+{
+public:
+    enum Operation {
+        WriteEntry = 1,
+        RemoveEntry = 2,
+        CreateFolder = 3,
+        RemoveFolder = 4,
+    };
+
+    struct Op {
+        Operation op;
+        QString folder;
+        QString key;
+        MD5Digest folderDigest;
+        MD5Digest keyDigest; // unused by folder operations
+
+        bool operator==(const Op &o) const
+        {
+            return op == o.op && folder == o.folder && key == o.key;
+        }
+    };
+
+    // Cleartext part of a record, as used to update the digest table.
+    struct DigestOp {
+        Operation op;
+        QByteArray folder;
+        QByteArray key;
+    };
+
+    Journal();
+
+    // Forget everything; the next sync rewrites the wallet.
+    void reset();
+
+    // The base image ends at @p offset and the records after it are intact.
+    void setBase(qint64 offset);
+    qint64 baseSize() const
+    {
+        return _base;
+    }
+
+    // Force the next sync to rewrite the wallet, e.g. after a password
+    // change or when the records on disk can't be trusted.
+    void invalidate()
+    {
+        _valid = false;
+    }
+    bool isValid() const
+    {
+        return _valid;
+    }
+
+    // Operations are only recorded while this is enabled, so replaying the
+    // journal doesn't queue the same changes again.
+    void setRecording(bool recording)
+    {
+        _recording = recording;
+    }
+
+    // The digests are those of the names, kept by the entry index.
+    void record(Operation op, const QString &folder, const MD5Digest &folderDigest, const QString &key = QString(), const MD5Digest &keyDigest = MD5Digest());
+    const QVector<Op> &pending() const
+    {
+        return _pending;
+    }
+    bool hasPending() const
+    {
+        return !_pending.isEmpty();
+    }
+    // The pending operations went to a snapshot being written, see
+    // Backend::startSync().
+    void clearPending()
+    {
+        _pending.clear();
+    }
+
+    // A record of @p size bytes has been appended (or replayed).
+    void committed(qint64 size);
+
+    // Bytes of records following the base image.
+    qint64 size() const
+    {
+        return _size;
+    }
+    int recordCount() const
+    {
+        return _records;
+    }
+
+    // True if the records should be folded into a fresh base image.
+    bool isCompactionDue() const;
+
+    // True if the next sync may append instead of rewriting the wallet.
+    bool canAppend() const;
+
+    // Frames the sealed payload of a record.
+    static QByteArray frame(const QVector<Op> &ops, const QByteArray &sealed);
+
+    // Reads the next record from @p dev. Returns false at the end of the
+    // file or if the record is incomplete (e.g. an interrupted append).
+    static bool readRecord(QIODevice *dev, QVector<DigestOp> &ops, QByteArray &sealed);
+    // Updates a digest table with the cleartext part of a record.
+    static void applyDigests(DigestTable &table, const QVector<DigestOp> &ops);
+
+private:
+    QVector<Op> _pending;
+    qint64 _base;
+    qint64 _size;
+    int _records;
+    bool _valid;
+    bool _recording;
+};
+
+}
+
+#endif
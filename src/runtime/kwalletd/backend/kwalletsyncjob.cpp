@@ -0,0 +1,38 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#include "kwalletsyncjob.h"
+#include "kwalletbackend.h"
+
+using namespace KWallet;
+
+SyncJob::SyncJob(Backend *snapshot, bool compact)
+    : _snapshot(snapshot)
+    , _compact(compact)
+    , _appendOnly(false)
+    , _result(0)
+{
+    // owned by the wallet, not by the pool
+    setAutoDelete(false);
+}
+
+SyncJob::~SyncJob()
+{
+    delete _snapshot;
+}
+
+void SyncJob::run()
+{
+    _result = _compact ? _snapshot->compact(0) : _snapshot->sync(0);
+    Q_EMIT finished(_result);
+    _done.release();
+}
+
+void SyncJob::wait()
+{
+    _done.acquire();
+    _done.release();
+}
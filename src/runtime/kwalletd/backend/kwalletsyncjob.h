@@ -0,0 +1,70 @@
+/*
+    This file is part of the KDE project
+
+    SPDX-License-Identifier: LGPL-2.0-or-later
+*/
+
+#ifndef _KWALLETSYNCJOB_H
+#define _KWALLETSYNCJOB_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QSemaphore>
+
+#include "kwalletbackend5_export.h"
+
+namespace KWallet
+{
+class Backend;
+
+/**
+ * @internal
+ * Writes a snapshot of a wallet to disk on a thread of the global pool,
+ * see Backend::startSync().
+ *
+ * finished() is emitted from that thread, so receivers living in the main
+ * thread get it through a queued connection. The job is then handed back
+ * to Backend::finishSync(), which takes the result in and disposes of it.
+ */
+class KWALLETBACKEND5_EXPORT SyncJob : public QObject, public QRunnable
+{
+    Q_OBJECT
+public:
+    // Takes ownership of @p snapshot.
+    SyncJob(Backend *snapshot, bool compact);
+    ~SyncJob() override;
+
+    void run() override;
+
+    // Blocks until run() returned.
+    void wait();
+
+    int result() const
+    {
+        return _result;
+    }
+
+    // True if the job only appends the pending changes to the journal.
+    // If that fails, the wallet is still to be rewritten.
+    bool appendsOnly() const
+    {
+        return _appendOnly;
+    }
+
+Q_SIGNALS:
+    void finished(int rc);
+
+private:
+    Q_DISABLE_COPY(SyncJob)
+    friend class Backend;
+
+    Backend *_snapshot;
+    bool _compact;
+    bool _appendOnly;
+    int _result;
+    QSemaphore _done;
+};
+
+}
+
+#endif
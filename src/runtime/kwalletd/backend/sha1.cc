@@ -29,6 +29,12 @@
 
 #include <string.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KWALLET_SHA1_SHANI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 // clang-format off
 // FIXME: this can be optimized to one instruction on most cpus.
 #define rol(x,y) ((x << y) | (x >> (32-y)))
@@ -54,20 +60,238 @@
 } while(0)
 // clang-format on
 
-SHA1::SHA1()
+// The reference implementation.
+static void transformPortable(uint32_t *h, const unsigned char *data, size_t blocks)
+{
+    for (; blocks > 0; --blocks, data += 64) {
+        unsigned int a, b, c, d, e, tm;
+        unsigned int x[16];
+
+        a = h[0];
+        b = h[1];
+        c = h[2];
+        d = h[3];
+        e = h[4];
+
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        memcpy(x, data, 64);
+#else
+        int i;
+        unsigned char *p2;
+        const unsigned char *_data = data;
+        for (i = 0, p2 = (unsigned char *)x;
+                i < 16; i++, p2 += 4) {
+            p2[3] = *_data++;
+            p2[2] = *_data++;
+            p2[1] = *_data++;
+            p2[0] = *_data++;
+        }
+#endif
+
+        R(a, b, c, d, e, F1, K1, x[ 0]);
+        R(e, a, b, c, d, F1, K1, x[ 1]);
+        R(d, e, a, b, c, F1, K1, x[ 2]);
+        R(c, d, e, a, b, F1, K1, x[ 3]);
+        R(b, c, d, e, a, F1, K1, x[ 4]);
+        R(a, b, c, d, e, F1, K1, x[ 5]);
+        R(e, a, b, c, d, F1, K1, x[ 6]);
+        R(d, e, a, b, c, F1, K1, x[ 7]);
+        R(c, d, e, a, b, F1, K1, x[ 8]);
+        R(b, c, d, e, a, F1, K1, x[ 9]);
+        R(a, b, c, d, e, F1, K1, x[10]);
+        R(e, a, b, c, d, F1, K1, x[11]);
+        R(d, e, a, b, c, F1, K1, x[12]);
+        R(c, d, e, a, b, F1, K1, x[13]);
+        R(b, c, d, e, a, F1, K1, x[14]);
+        R(a, b, c, d, e, F1, K1, x[15]);
+        R(e, a, b, c, d, F1, K1, M(16));
+        R(d, e, a, b, c, F1, K1, M(17));
+        R(c, d, e, a, b, F1, K1, M(18));
+        R(b, c, d, e, a, F1, K1, M(19));
+        R(a, b, c, d, e, F2, K2, M(20));
+        R(e, a, b, c, d, F2, K2, M(21));
+        R(d, e, a, b, c, F2, K2, M(22));
+        R(c, d, e, a, b, F2, K2, M(23));
+        R(b, c, d, e, a, F2, K2, M(24));
+        R(a, b, c, d, e, F2, K2, M(25));
+        R(e, a, b, c, d, F2, K2, M(26));
+        R(d, e, a, b, c, F2, K2, M(27));
+        R(c, d, e, a, b, F2, K2, M(28));
+        R(b, c, d, e, a, F2, K2, M(29));
+        R(a, b, c, d, e, F2, K2, M(30));
+        R(e, a, b, c, d, F2, K2, M(31));
+        R(d, e, a, b, c, F2, K2, M(32));
+        R(c, d, e, a, b, F2, K2, M(33));
+        R(b, c, d, e, a, F2, K2, M(34));
+        R(a, b, c, d, e, F2, K2, M(35));
+        R(e, a, b, c, d, F2, K2, M(36));
+        R(d, e, a, b, c, F2, K2, M(37));
+        R(c, d, e, a, b, F2, K2, M(38));
+        R(b, c, d, e, a, F2, K2, M(39));
+        R(a, b, c, d, e, F3, K3, M(40));
+        R(e, a, b, c, d, F3, K3, M(41));
+        R(d, e, a, b, c, F3, K3, M(42));
+        R(c, d, e, a, b, F3, K3, M(43));
+        R(b, c, d, e, a, F3, K3, M(44));
+        R(a, b, c, d, e, F3, K3, M(45));
+        R(e, a, b, c, d, F3, K3, M(46));
+        R(d, e, a, b, c, F3, K3, M(47));
+        R(c, d, e, a, b, F3, K3, M(48));
+        R(b, c, d, e, a, F3, K3, M(49));
+        R(a, b, c, d, e, F3, K3, M(50));
+        R(e, a, b, c, d, F3, K3, M(51));
+        R(d, e, a, b, c, F3, K3, M(52));
+        R(c, d, e, a, b, F3, K3, M(53));
+        R(b, c, d, e, a, F3, K3, M(54));
+        R(a, b, c, d, e, F3, K3, M(55));
+        R(e, a, b, c, d, F3, K3, M(56));
+        R(d, e, a, b, c, F3, K3, M(57));
+        R(c, d, e, a, b, F3, K3, M(58));
+        R(b, c, d, e, a, F3, K3, M(59));
+        R(a, b, c, d, e, F4, K4, M(60));
+        R(e, a, b, c, d, F4, K4, M(61));
+        R(d, e, a, b, c, F4, K4, M(62));
+        R(c, d, e, a, b, F4, K4, M(63));
+        R(b, c, d, e, a, F4, K4, M(64));
+        R(a, b, c, d, e, F4, K4, M(65));
+        R(e, a, b, c, d, F4, K4, M(66));
+        R(d, e, a, b, c, F4, K4, M(67));
+        R(c, d, e, a, b, F4, K4, M(68));
+        R(b, c, d, e, a, F4, K4, M(69));
+        R(a, b, c, d, e, F4, K4, M(70));
+        R(e, a, b, c, d, F4, K4, M(71));
+        R(d, e, a, b, c, F4, K4, M(72));
+        R(c, d, e, a, b, F4, K4, M(73));
+        R(b, c, d, e, a, F4, K4, M(74));
+        R(a, b, c, d, e, F4, K4, M(75));
+        R(e, a, b, c, d, F4, K4, M(76));
+        R(d, e, a, b, c, F4, K4, M(77));
+        R(c, d, e, a, b, F4, K4, M(78));
+        R(b, c, d, e, a, F4, K4, M(79));
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+}
+
+#ifdef KWALLET_SHA1_SHANI
+// Four rounds with the SHA extensions, following Intel's reference code.
+// The message words of the group are in msg[g % 4], those of the next
+// groups are computed along the way.
+// clang-format off
+#define ROUNDS4(g) do {                                                                         \
+        if (g == 0) {                                                                           \
+            e[0] = _mm_add_epi32(e[0], msg[0]);                                                 \
+        } else {                                                                                \
+            e[g % 2] = _mm_sha1nexte_epu32(e[g % 2], msg[g % 4]);                               \
+        }                                                                                       \
+        e[(g + 1) % 2] = abcd;                                                                  \
+        if (g >= 3 && g <= 18) {                                                                \
+            msg[(g + 1) % 4] = _mm_sha1msg2_epu32(msg[(g + 1) % 4], msg[g % 4]);                \
+        }                                                                                       \
+        abcd = _mm_sha1rnds4_epu32(abcd, e[g % 2], g / 5);                                      \
+        if (g >= 1 && g <= 16) {                                                                \
+            msg[(g + 3) % 4] = _mm_sha1msg1_epu32(msg[(g + 3) % 4], msg[g % 4]);                \
+        }                                                                                       \
+        if (g >= 2 && g <= 17) {                                                                \
+            msg[(g + 2) % 4] = _mm_xor_si128(msg[(g + 2) % 4], msg[g % 4]);                     \
+        }                                                                                       \
+    } while (0)
+// clang-format on
+
+__attribute__((target("sha,sse4.1"))) static void transformShaNi(uint32_t *h, const unsigned char *data, size_t blocks)
+{
+    // a in the highest lane, e alone in it
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(h)), 0x1B);
+    __m128i e[2] = {_mm_set_epi32(h[4], 0, 0, 0), _mm_setzero_si128()};
+    __m128i msg[4];
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i abcdSave = abcd;
+        const __m128i eSave = e[0];
+
+        // the words are taken in host order, like transformPortable() does,
+        // the first one in the highest lane
+        for (int i = 0; i < 4; ++i) {
+            msg[i] = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * i)), 0x1B);
+        }
+
+        ROUNDS4(0);
+        ROUNDS4(1);
+        ROUNDS4(2);
+        ROUNDS4(3);
+        ROUNDS4(4);
+        ROUNDS4(5);
+        ROUNDS4(6);
+        ROUNDS4(7);
+        ROUNDS4(8);
+        ROUNDS4(9);
+        ROUNDS4(10);
+        ROUNDS4(11);
+        ROUNDS4(12);
+        ROUNDS4(13);
+        ROUNDS4(14);
+        ROUNDS4(15);
+        ROUNDS4(16);
+        ROUNDS4(17);
+        ROUNDS4(18);
+        ROUNDS4(19);
+
+        e[0] = _mm_sha1nexte_epu32(e[0], eSave);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(h), _mm_shuffle_epi32(abcd, 0x1B));
+    h[4] = _mm_extract_epi32(e[0], 3);
+}
+
+#undef ROUNDS4
+
+static bool hasShaExtensions()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1)) {
+        return false;
+    }
+    if (__get_cpuid_max(0, nullptr) < 7) {
+        return false;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return ebx & (1 << 29); // SHA
+}
+#endif
+
+SHA1::SHA1(bool accelerated)
 {
     _hashlen = 160;
     _init = false;
+    _transform = transformPortable;
+#ifdef KWALLET_SHA1_SHANI
+    static const bool shaExtensions = hasShaExtensions();
+    if (accelerated && shaExtensions) {
+        _transform = transformShaNi;
+    }
+#else
+    (void)accelerated;
+#endif
     reset();
 }
 
+bool SHA1::isAccelerated() const
+{
+    return _transform != transformPortable;
+}
+
 int SHA1::reset()
 {
-    _h0 = 0x67452301;
-    _h1 = 0xefcdab89;
-    _h2 = 0x98badcfe;
-    _h3 = 0x10325476;
-    _h4 = 0xc3d2e1f0;
+    _h[0] = 0x67452301;
+    _h[1] = 0xefcdab89;
+    _h[2] = 0x98badcfe;
+    _h[3] = 0x10325476;
+    _h[4] = 0xc3d2e1f0;
     _nblocks = 0;
     _count = 0;
     memset(_buf, 0, 56);      // clear the buffer
@@ -86,121 +310,6 @@ SHA1::~SHA1()
 
 }
 
-void SHA1::transform(void *data)
-{
-    unsigned int a, b, c, d, e, tm;
-    unsigned int x[16];
-    unsigned char *_data = (unsigned char *)data;
-
-    a = _h0;
-    b = _h1;
-    c = _h2;
-    d = _h3;
-    e = _h4;
-
-#if Q_BYTE_ORDER == Q_BIG_ENDIAN
-    memcpy(x, _data, 64);
-#else
-    int i;
-    unsigned char *p2;
-    for (i = 0, p2 = (unsigned char *)x;
-            i < 16; i++, p2 += 4) {
-        p2[3] = *_data++;
-        p2[2] = *_data++;
-        p2[1] = *_data++;
-        p2[0] = *_data++;
-    }
-#endif
-
-    R(a, b, c, d, e, F1, K1, x[ 0]);
-    R(e, a, b, c, d, F1, K1, x[ 1]);
-    R(d, e, a, b, c, F1, K1, x[ 2]);
-    R(c, d, e, a, b, F1, K1, x[ 3]);
-    R(b, c, d, e, a, F1, K1, x[ 4]);
-    R(a, b, c, d, e, F1, K1, x[ 5]);
-    R(e, a, b, c, d, F1, K1, x[ 6]);
-    R(d, e, a, b, c, F1, K1, x[ 7]);
-    R(c, d, e, a, b, F1, K1, x[ 8]);
-    R(b, c, d, e, a, F1, K1, x[ 9]);
-    R(a, b, c, d, e, F1, K1, x[10]);
-    R(e, a, b, c, d, F1, K1, x[11]);
-    R(d, e, a, b, c, F1, K1, x[12]);
-    R(c, d, e, a, b, F1, K1, x[13]);
-    R(b, c, d, e, a, F1, K1, x[14]);
-    R(a, b, c, d, e, F1, K1, x[15]);
-    R(e, a, b, c, d, F1, K1, M(16));
-    R(d, e, a, b, c, F1, K1, M(17));
-    R(c, d, e, a, b, F1, K1, M(18));
-    R(b, c, d, e, a, F1, K1, M(19));
-    R(a, b, c, d, e, F2, K2, M(20));
-    R(e, a, b, c, d, F2, K2, M(21));
-    R(d, e, a, b, c, F2, K2, M(22));
-    R(c, d, e, a, b, F2, K2, M(23));
-    R(b, c, d, e, a, F2, K2, M(24));
-    R(a, b, c, d, e, F2, K2, M(25));
-    R(e, a, b, c, d, F2, K2, M(26));
-    R(d, e, a, b, c, F2, K2, M(27));
-    R(c, d, e, a, b, F2, K2, M(28));
-    R(b, c, d, e, a, F2, K2, M(29));
-    R(a, b, c, d, e, F2, K2, M(30));
-    R(e, a, b, c, d, F2, K2, M(31));
-    R(d, e, a, b, c, F2, K2, M(32));
-    R(c, d, e, a, b, F2, K2, M(33));
-    R(b, c, d, e, a, F2, K2, M(34));
-    R(a, b, c, d, e, F2, K2, M(35));
-    R(e, a, b, c, d, F2, K2, M(36));
-    R(d, e, a, b, c, F2, K2, M(37));
-    R(c, d, e, a, b, F2, K2, M(38));
-    R(b, c, d, e, a, F2, K2, M(39));
-    R(a, b, c, d, e, F3, K3, M(40));
-    R(e, a, b, c, d, F3, K3, M(41));
-    R(d, e, a, b, c, F3, K3, M(42));
-    R(c, d, e, a, b, F3, K3, M(43));
-    R(b, c, d, e, a, F3, K3, M(44));
-    R(a, b, c, d, e, F3, K3, M(45));
-    R(e, a, b, c, d, F3, K3, M(46));
-    R(d, e, a, b, c, F3, K3, M(47));
-    R(c, d, e, a, b, F3, K3, M(48));
-    R(b, c, d, e, a, F3, K3, M(49));
-    R(a, b, c, d, e, F3, K3, M(50));
-    R(e, a, b, c, d, F3, K3, M(51));
-    R(d, e, a, b, c, F3, K3, M(52));
-    R(c, d, e, a, b, F3, K3, M(53));
-    R(b, c, d, e, a, F3, K3, M(54));
-    R(a, b, c, d, e, F3, K3, M(55));
-    R(e, a, b, c, d, F3, K3, M(56));
-    R(d, e, a, b, c, F3, K3, M(57));
-    R(c, d, e, a, b, F3, K3, M(58));
-    R(b, c, d, e, a, F3, K3, M(59));
-    R(a, b, c, d, e, F4, K4, M(60));
-    R(e, a, b, c, d, F4, K4, M(61));
-    R(d, e, a, b, c, F4, K4, M(62));
-    R(c, d, e, a, b, F4, K4, M(63));
-    R(b, c, d, e, a, F4, K4, M(64));
-    R(a, b, c, d, e, F4, K4, M(65));
-    R(e, a, b, c, d, F4, K4, M(66));
-    R(d, e, a, b, c, F4, K4, M(67));
-    R(c, d, e, a, b, F4, K4, M(68));
-    R(b, c, d, e, a, F4, K4, M(69));
-    R(a, b, c, d, e, F4, K4, M(70));
-    R(e, a, b, c, d, F4, K4, M(71));
-    R(d, e, a, b, c, F4, K4, M(72));
-    R(c, d, e, a, b, F4, K4, M(73));
-    R(b, c, d, e, a, F4, K4, M(74));
-    R(a, b, c, d, e, F4, K4, M(75));
-    R(e, a, b, c, d, F4, K4, M(76));
-    R(d, e, a, b, c, F4, K4, M(77));
-    R(c, d, e, a, b, F4, K4, M(78));
-    R(b, c, d, e, a, F4, K4, M(79));
-
-    _h0 += a;
-    _h1 += b;
-    _h2 += c;
-    _h3 += d;
-    _h4 += e;
-
-}
-
 bool SHA1::readyToGo() const
 {
     return _init;
@@ -217,7 +326,7 @@ int SHA1::process(const void *block, int len)
     int cnt = 0;
     // Flush the buffer before proceeding
     if (_count == 64) {
-        transform(_buf);
+        _transform(_h, _buf, 1);
         _count = 0;
         _nblocks++;
     }
@@ -236,13 +345,14 @@ int SHA1::process(const void *block, int len)
         }
     }
 
-    while (len >= 64) {
-        transform(_block);
+    if (len >= 64) {
+        const int blocks = len / 64;
+        _transform(_h, _block, blocks);
         _count = 0;
-        _nblocks++;
-        len -= 64;
-        cnt += 64;
-        _block += 64;
+        _nblocks += blocks;
+        len -= 64 * blocks;
+        cnt += 64 * blocks;
+        _block += 64 * blocks;
     }
 
     for (; len && _count < 64; --len, ++cnt) {
@@ -308,15 +418,15 @@ const unsigned char *SHA1::hash()
     _buf[62] = lsb >>  8;
     _buf[63] = lsb;
 
-    transform(_buf);
+    _transform(_h, _buf, 1);
 
     p = _buf;
 // clang-format off
 #if Q_BYTE_ORDER == Q_BIG_ENDIAN
-#define X(a) do { *(uint32_t *)p = _h##a; p += 4; } while (0)
+#define X(a) do { memcpy(p, &_h[a], 4); p += 4; } while (0)
 #else
-#define X(a) do { *p++ = _h##a >> 24;  *p++ = _h##a >> 16;             \
-        *p++ = _h##a >>  8;  *p++ = _h##a;        } while (0)
+#define X(a) do { *p++ = _h[a] >> 24;  *p++ = _h[a] >> 16;             \
+        *p++ = _h[a] >>  8;  *p++ = _h[a];        } while (0)
 #endif
 // clang-format on
 
@@ -13,14 +13,29 @@
 
 #include "kwalletbackend5_export.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
 /* @internal
+ *   Careful: on little endian hosts this reads the message as 32 bit words in
+ *   host order, so it is not the standard SHA1 there.  The wallet formats
+ *   depend on it.
  */
 class KWALLETBACKEND5_EXPORT SHA1
 {
 public:
-    SHA1();
+    /*
+     *  Unless @p accelerated is false, the blocks are processed with the SHA
+     *  extensions of the CPU when it has them.  The result is the same.
+     */
+    explicit SHA1(bool accelerated = true);
     ~SHA1();
 
+    /*
+     *  True if the blocks are processed with the SHA extensions.
+     */
+    bool isAccelerated() const;
+
     /*
      *  The number of bits in the hash generated.
      */
@@ -51,11 +66,14 @@ protected:
     int _hashlen;
     bool _init;
 
-    long _h0, _h1, _h2, _h3, _h4;
+    uint32_t _h[5];
     long _nblocks;
     int _count;
     unsigned char _buf[64];
-    void transform(void *data);
+
+    // Processes whole blocks of 64 bytes.
+    typedef void (*Transform)(uint32_t *h, const unsigned char *data, size_t blocks);
+    Transform _transform;
 };
 
 #endif
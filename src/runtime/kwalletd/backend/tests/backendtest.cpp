@@ -5,6 +5,8 @@
 #include <QString>
 
 #include "kwalletbackend.h"
+#include "kwalletentry.h"
+#include "kwalletsyncjob.h"
 
 int main(int argc, char **argv)
 {
@@ -12,6 +14,7 @@ int main(int argc, char **argv)
     a.setApplicationName(QStringLiteral("backendtest"));
 
     KWallet::Backend be(QStringLiteral("ktestwallet"));
+    be.setCipherType(KWallet::BACKEND_CIPHER_BLOWFISH);
     printf("KWalletBackend constructed\n");
 
     QByteArray apass("apassword", 9);
@@ -40,5 +43,53 @@ int main(int argc, char **argv)
 
     printf("be.open(bpass) returned %d  (should be 0)\n", rc);
 
+    KWallet::Entry e;
+    e.setType(KWallet::Wallet::Password);
+    e.setKey(QStringLiteral("before"));
+    e.setValue(QStringLiteral("value"));
+    be.setFolder(QStringLiteral("folder"));
+    be.writeEntry(&e);
+
+    KWallet::SyncJob *job = be.startSync();
+
+    printf("be.startSync() returned %p  (should not be null)\n", static_cast<void *>(job));
+
+    // written while the snapshot is
+    e.setKey(QStringLiteral("during"));
+    be.writeEntry(&e);
+
+    rc = be.close(true);
+
+    printf("be.close(true) returned %d  (should be 0)\n", rc);
+
+    rc = be.open(bpass);
+    be.setFolder(QStringLiteral("folder"));
+    const bool found = be.hasEntry(QStringLiteral("before")) && be.hasEntry(QStringLiteral("during"));
+
+    printf("both entries found after reopening: %s  (should be yes)\n", found ? "yes" : "no");
+
+    printf("be.entryDoesNotExist(\"folder\", \"before\") returned %d  (should be 0)\n",
+           be.entryDoesNotExist(QStringLiteral("folder"), QStringLiteral("before")));
+
+    printf("be.isDirty() returned %d  (should be 0)\n", be.isDirty());
+
+    be.removeEntry(QStringLiteral("during"));
+
+    printf("be.pendingChanges() returned %llu  (should be 1)\n", static_cast<unsigned long long>(be.pendingChanges()));
+
+    rc = be.sync(0);
+
+    printf("be.sync() returned %d, be.isDirty() returned %d  (should be 0, 0)\n", rc, be.isDirty());
+
+    // only the change is copied to be appended
+    be.writeEntry(&e);
+    job = be.startSync();
+
+    printf("job->appendsOnly() returned %d  (should be 1)\n", job && job->appendsOnly());
+
+    rc = be.finishSync();
+
+    printf("be.finishSync() returned %d, be.isDirty() returned %d  (should be 0, 0)\n", rc, be.isDirty());
+
     return 0;
 }
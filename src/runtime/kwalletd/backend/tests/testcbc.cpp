@@ -0,0 +1,112 @@
+#include "blowfish.h"
+#include "cbc.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QThreadPool>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char key[] = "testkey for the chain";
+
+static QByteArray randomData(int size)
+{
+    QByteArray data(size, 0);
+    for (int i = 0; i < size; ++i) {
+        data[i] = char(rand());
+    }
+    return data;
+}
+
+static QByteArray encrypt(const QByteArray &plain)
+{
+    BlowFish bf;
+    CipherBlockChain cbc(&bf);
+    cbc.setKey(key, (sizeof(key) - 1) * 8);
+    QByteArray data = plain;
+    cbc.encrypt(data.data(), data.size());
+    return data;
+}
+
+// Decrypts one block at a time, the way it was always done.
+static QByteArray decryptSerially(const QByteArray &encrypted)
+{
+    BlowFish bf;
+    bf.setKey(key, (sizeof(key) - 1) * 8);
+    QByteArray data = encrypted;
+    char prev[8] = {0};
+    for (int i = 0; i < data.size(); i += 8) {
+        char next[8];
+        memcpy(next, data.constData() + i, 8);
+        bf.decrypt(data.data() + i, 8);
+        for (int j = 0; j < 8; ++j) {
+            data[i + j] = data.at(i + j) ^ prev[j];
+        }
+        memcpy(prev, next, 8);
+    }
+    return data;
+}
+
+static int decrypt(QByteArray &data)
+{
+    BlowFish bf;
+    CipherBlockChain cbc(&bf);
+    cbc.setKey(key, (sizeof(key) - 1) * 8);
+    return cbc.decrypt(data.data(), data.size());
+}
+
+// Sizes on both sides of the parallel threshold, and uneven splits.
+static bool check()
+{
+    const int sizes[] = {8, 512, 520, 64 * 1024, 256 * 1024, 256 * 1024 + 8, 1024 * 1024 + 24, 3 * 1024 * 1024 + 8 * 7};
+    for (int size : sizes) {
+        const QByteArray plain = randomData(size);
+        const QByteArray encrypted = encrypt(plain);
+        if (decryptSerially(encrypted) != plain) {
+            printf("Error: the reference decryption of %d bytes failed.\n", size);
+            return false;
+        }
+        QByteArray data = encrypted;
+        if (decrypt(data) != size || data != plain) {
+            printf("Error: decrypting %d bytes failed.\n", size);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Throughput of the decryption with a growing number of threads.
+static void benchmark(int size)
+{
+    const QByteArray encrypted = encrypt(randomData(size));
+    const int maxThreads = QThread::idealThreadCount();
+    QElapsedTimer timer;
+
+    timer.start();
+    decryptSerially(encrypted);
+    printf("%3d MiB: block by block %5lld MiB/s", size >> 20, qint64(size >> 20) * 1000 / qMax<qint64>(timer.elapsed(), 1));
+
+    for (int threads = 2; threads <= maxThreads; threads *= 2) {
+        // the calling thread decrypts a part too
+        QThreadPool::globalInstance()->setMaxThreadCount(threads - 1);
+        QByteArray data = encrypted;
+        timer.start();
+        decrypt(data);
+        printf(", %d threads %5lld MiB/s", threads, qint64(size >> 20) * 1000 / qMax<qint64>(timer.elapsed(), 1));
+    }
+    printf("\n");
+}
+
+int main()
+{
+    if (!check()) {
+        return -1;
+    }
+    printf("Parallel CBC decryption matches.\n");
+
+    benchmark(4 << 20);
+    benchmark(32 << 20);
+    return 0;
+}
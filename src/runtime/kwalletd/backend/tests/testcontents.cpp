@@ -0,0 +1,143 @@
+#include "kwalletbackend.h"
+#include "kwalletcontents.h"
+#include "kwalletentry.h"
+
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+using namespace KWallet;
+
+static const QString walletName = QStringLiteral("testcontents");
+
+static void removeWallet()
+{
+    const QString path = Backend::getSaveLocation() + QStringLiteral("/") + walletName;
+    QFile::remove(path + QStringLiteral(".kwl"));
+    QFile::remove(path + QStringLiteral(".salt"));
+}
+
+static void writeEntry(Backend &b, const QString &folder, const QString &key, const QByteArray &value)
+{
+    Entry e;
+    e.setKey(key);
+    e.setType(Wallet::Stream);
+    e.setValue(value);
+    b.setFolder(folder);
+    b.writeEntry(&e);
+}
+
+static QByteArray valueOf(const Contents &c, const QString &folder, const QString &key)
+{
+    const Contents::Item *item = c.entry(folder, key);
+    return item ? item->value() : QByteArray("(none)");
+}
+
+// Versions don't change once made, and see the folders as they were.
+static bool check()
+{
+    removeWallet();
+    {
+        Backend b(walletName);
+        b.setCipherType(BACKEND_CIPHER_BLOWFISH);
+        b.open(QByteArray("password"));
+        writeEntry(b, QStringLiteral("one"), QStringLiteral("a"), "1");
+        writeEntry(b, QStringLiteral("two"), QStringLiteral("a"), "2");
+        b.compact(0); // stores it as segments
+        b.close(false);
+    }
+
+    Backend b(walletName);
+    b.open(QByteArray("password"));
+    b.setFolder(QStringLiteral("one"));
+    const Contents first = b.contents();
+    if (first.folderList() != QStringList({QStringLiteral("one"), QStringLiteral("two")}) || valueOf(first, QStringLiteral("one"), QStringLiteral("a")) != "1") {
+        printf("Error: the first version is wrong.\n");
+        return false;
+    }
+    if (first.isSealed(QStringLiteral("one")) || !first.isSealed(QStringLiteral("two"))) {
+        printf("Error: only the folder not decrypted yet should be sealed.\n");
+        return false;
+    }
+
+    writeEntry(b, QStringLiteral("one"), QStringLiteral("a"), "changed");
+    writeEntry(b, QStringLiteral("one"), QStringLiteral("b"), "new");
+    b.removeFolder(QStringLiteral("two"));
+    if (b.publishedContents().hasFolder(QStringLiteral("two")) == false) {
+        printf("Error: changes were published before contents() was called.\n");
+        return false;
+    }
+
+    const Contents second = b.contents();
+    if (valueOf(first, QStringLiteral("one"), QStringLiteral("a")) != "1" || first.entryList(QStringLiteral("one")).count() != 1
+        || !first.hasFolder(QStringLiteral("two"))) {
+        printf("Error: the first version changed.\n");
+        return false;
+    }
+    if (valueOf(second, QStringLiteral("one"), QStringLiteral("a")) != "changed" || valueOf(second, QStringLiteral("one"), QStringLiteral("b")) != "new"
+        || second.hasFolder(QStringLiteral("two")) || second.generation() <= first.generation()) {
+        printf("Error: the second version is wrong.\n");
+        return false;
+    }
+
+    b.close(false);
+    if (b.publishedContents().hasFolder(QStringLiteral("one")) || valueOf(second, QStringLiteral("one"), QStringLiteral("b")) != "new") {
+        printf("Error: closing the wallet went wrong.\n");
+        return false;
+    }
+    return true;
+}
+
+// Readers on other threads see either all or none of the changes made
+// between two calls to contents().
+static bool checkReaders()
+{
+    Backend b(walletName);
+    b.open(QByteArray("password"));
+    b.contents();
+
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::atomic<long> reads(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            while (!done) {
+                const Contents c = b.publishedContents();
+                if (valueOf(c, QStringLiteral("one"), QStringLiteral("a")) != valueOf(c, QStringLiteral("one"), QStringLiteral("b"))) {
+                    ++errors;
+                }
+                ++reads;
+            }
+        });
+    }
+
+    for (int i = 0; i < 2000; ++i) {
+        const QByteArray value = QByteArray::number(i);
+        writeEntry(b, QStringLiteral("one"), QStringLiteral("a"), value);
+        writeEntry(b, QStringLiteral("one"), QStringLiteral("b"), value);
+        b.contents();
+    }
+    done = true;
+    for (std::thread &t : readers) {
+        t.join();
+    }
+    b.close(false);
+
+    printf("%ld reads while writing, %d inconsistent\n", long(reads), int(errors));
+    return errors == 0;
+}
+
+int main()
+{
+    const bool ok = check() && checkReaders();
+    removeWallet();
+    if (!ok) {
+        return -1;
+    }
+    printf("Wallet contents are consistent.\n");
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "kwalletentry.h"
+#include "kwalletentryindex.h"
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace KWallet;
+
+typedef QMap<QString, Entry *> EntryMap;
+typedef QMap<QString, EntryMap> FolderMap;
+
+static const int folderCount = 32;
+
+static QString folderName(int i)
+{
+    return QStringLiteral("Folder %1").arg(i % folderCount);
+}
+
+static QString keyName(int i)
+{
+    return QStringLiteral("https://example.org/account/%1").arg(i);
+}
+
+// Random insertions and removals, checked against nested maps.
+static bool check()
+{
+    FolderMap reference;
+    EntryIndex index;
+    QVector<Entry> entries(512);
+
+    srand(1);
+    for (int n = 0; n < 20000; ++n) {
+        const int i = rand() % entries.count();
+        const QString folder = folderName(rand() % 8);
+        const QString key = keyName(i);
+        switch (rand() % 4) {
+        case 0:
+        case 1:
+            reference[folder][key] = &entries[i];
+            index.insert(folder, key, &entries[i]);
+            break;
+        case 2:
+            if (index.take(folder, key) != reference[folder].take(key)) {
+                printf("Error: removing %s failed.\n", qPrintable(key));
+                return false;
+            }
+            break;
+        case 3:
+            if (rand() % 64 == 0) {
+                reference.remove(folder);
+                index.takeFolder(folder);
+            }
+            break;
+        }
+    }
+
+    for (FolderMap::ConstIterator f = reference.constBegin(); f != reference.constEnd(); ++f) {
+        if (index.keys(f.key()) != f.value().keys() || index.values(f.key()) != f.value().values()) {
+            printf("Error: folder %s differs.\n", qPrintable(f.key()));
+            return false;
+        }
+        for (EntryMap::ConstIterator e = f.value().constBegin(); e != f.value().constEnd(); ++e) {
+            if (index.value(f.key(), e.key()) != e.value()) {
+                printf("Error: entry %s differs.\n", qPrintable(e.key()));
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Lookups of existing keys per second, nested maps vs. the index.
+static void benchmark(int count)
+{
+    FolderMap maps;
+    EntryIndex index;
+    Entry entry;
+    QStringList folders;
+    QStringList keys;
+
+    for (int i = 0; i < count; ++i) {
+        folders.append(folderName(i));
+        keys.append(keyName(i));
+        maps[folders.last()][keys.last()] = &entry;
+        index.insert(folders.last(), keys.last(), &entry);
+    }
+
+    const int lookups = 1000000;
+    int found = 0;
+    int n = 0;
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int i = 0; i < lookups; ++i) {
+        n = (n + 7919) % count;
+        const FolderMap::ConstIterator f = maps.constFind(folders.at(n));
+        found += f != maps.constEnd() && f.value().contains(keys.at(n));
+    }
+    const qint64 mapTime = qMax<qint64>(timer.elapsed(), 1);
+
+    timer.start();
+    for (int i = 0; i < lookups; ++i) {
+        n = (n + 7919) % count;
+        found += index.value(folders.at(n), keys.at(n)) != nullptr;
+    }
+    const qint64 indexTime = qMax<qint64>(timer.elapsed(), 1);
+
+    printf("%6d entries: QMap %8lld lookups/ms, EntryIndex %8lld lookups/ms (%d found)\n",
+           count, lookups / mapTime, lookups / indexTime, found);
+}
+
+int main()
+{
+    if (!check()) {
+        return -1;
+    }
+    printf("Entry index matches QMap.\n");
+
+    benchmark(1000);
+    benchmark(10000);
+    benchmark(100000);
+    return 0;
+}
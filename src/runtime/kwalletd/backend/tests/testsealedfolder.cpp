@@ -0,0 +1,176 @@
+#include "kwalletbackend.h"
+#include "kwalletentry.h"
+
+#include <QFile>
+#include <QString>
+#include <stdio.h>
+
+using namespace KWallet;
+
+static const QString walletName = QStringLiteral("testsealedfolder");
+
+static QString walletPath()
+{
+    return Backend::getSaveLocation() + QStringLiteral("/") + walletName + QStringLiteral(".kwl");
+}
+
+static void removeWallet()
+{
+    QFile::remove(walletPath());
+    QFile::remove(Backend::getSaveLocation() + QStringLiteral("/") + walletName + QStringLiteral(".salt"));
+}
+
+static bool writeEntry(Backend &b, const QString &folder, const QString &key, const QByteArray &value)
+{
+    Entry e;
+    e.setKey(key);
+    e.setType(Wallet::Stream);
+    e.setValue(value);
+    b.setFolder(folder);
+    return b.writeEntry(&e);
+}
+
+static QByteArray readWallet()
+{
+    QFile f(walletPath());
+    f.open(QIODevice::ReadOnly);
+    return f.readAll();
+}
+
+// Flips a bit of the last segment, the one of folder "two".
+static void breakSegment(qint64 end)
+{
+    QByteArray data = readWallet();
+    data[int(end) - 1] = char(data.at(int(end) - 1) ^ 1);
+    QFile f(walletPath());
+    f.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    f.write(data);
+}
+
+// A folder which can't be decrypted can't be changed either, and says so.
+static bool checkWrites()
+{
+    removeWallet();
+    {
+        Backend b(walletName);
+        b.setCipherType(BACKEND_CIPHER_BLOWFISH);
+        b.open(QByteArray("password"));
+        writeEntry(b, QStringLiteral("one"), QStringLiteral("a"), "1");
+        writeEntry(b, QStringLiteral("two"), QStringLiteral("a"), "2");
+        b.compact(0); // stores it as segments
+        b.close(false);
+    }
+    breakSegment(readWallet().size());
+
+    Backend b(walletName);
+    if (b.open(QByteArray("password")) != 0) {
+        printf("Error: the wallet doesn't open with a broken segment.\n");
+        return false;
+    }
+    if (!writeEntry(b, QStringLiteral("one"), QStringLiteral("b"), "3")) {
+        printf("Error: the intact folder can't be written.\n");
+        return false;
+    }
+    if (writeEntry(b, QStringLiteral("two"), QStringLiteral("b"), "4") || !b.isFolderEncrypted(QStringLiteral("two"))) {
+        printf("Error: writing to the broken folder didn't fail.\n");
+        return false;
+    }
+    if (b.removeEntry(QStringLiteral("a"))) {
+        printf("Error: removing from the broken folder didn't fail.\n");
+        return false;
+    }
+    b.close(false);
+    return true;
+}
+
+// Replacing @p from with @p to in the wallet file.
+static bool patchWallet(const QByteArray &from, const QByteArray &to)
+{
+    QByteArray data = readWallet();
+    const int i = data.indexOf(from);
+    if (i < 0) {
+        return false;
+    }
+    data.replace(i, from.size(), to);
+    QFile f(walletPath());
+    f.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    return f.write(data) == data.size();
+}
+
+// The journal records for such a folder are kept rather than dropped, and
+// the rest of the wallet opens.
+static bool checkJournal()
+{
+    removeWallet();
+    qint64 base;
+    {
+        Backend b(walletName);
+        b.setCipherType(BACKEND_CIPHER_BLOWFISH);
+        b.open(QByteArray("password"));
+        writeEntry(b, QStringLiteral("one"), QStringLiteral("a"), "1");
+        writeEntry(b, QStringLiteral("two"), QStringLiteral("a"), "2");
+        b.compact(0);
+        b.close(false);
+        base = readWallet().size();
+    }
+    {
+        Backend b(walletName);
+        b.open(QByteArray("password"));
+        writeEntry(b, QStringLiteral("two"), QStringLiteral("b"), "journaled");
+        b.close(true);
+    }
+    if (readWallet().size() <= base) {
+        printf("Error: the change wasn't appended to the journal.\n");
+        return false;
+    }
+    const QByteArray intact = readWallet().mid(int(base) - 32, 32);
+    breakSegment(base);
+    const QByteArray broken = readWallet().mid(int(base) - 32, 32);
+
+    {
+        Backend b(walletName);
+        if (b.open(QByteArray("password")) != 0) {
+            printf("Error: the wallet doesn't open with a journaled change to a broken folder.\n");
+            return false;
+        }
+        b.setFolder(QStringLiteral("one"));
+        if (!b.readEntry(QStringLiteral("a")) || !b.isFolderEncrypted(QStringLiteral("two"))) {
+            printf("Error: the intact folder wasn't opened.\n");
+            return false;
+        }
+        // a new base image, which doesn't hold the change
+        writeEntry(b, QStringLiteral("one"), QStringLiteral("b"), "3");
+        b.compact(0);
+        b.close(false);
+    }
+
+    // once the segment is readable again, so is the change
+    if (!patchWallet(broken, intact)) {
+        printf("Error: the broken segment wasn't written back.\n");
+        return false;
+    }
+    Backend b(walletName);
+    if (b.open(QByteArray("password")) != 0) {
+        printf("Error: the repaired wallet doesn't open.\n");
+        return false;
+    }
+    b.setFolder(QStringLiteral("two"));
+    Entry *e = b.readEntry(QStringLiteral("b"));
+    if (!e || e->value() != "journaled") {
+        printf("Error: the journaled change was lost by the compaction.\n");
+        return false;
+    }
+    b.close(false);
+    return true;
+}
+
+int main()
+{
+    const bool ok = checkWrites() && checkJournal();
+    removeWallet();
+    if (!ok) {
+        return -1;
+    }
+    printf("Folders which can't be decrypted are left alone.\n");
+    return 0;
+}
@@ -1,10 +1,59 @@
 #include "sha1.h"
+#include <QByteArray>
+#include <QElapsedTimer>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// The SHA extensions give the same digests as the reference code, for any
+// length and however the data is split.
+static bool check()
+{
+    srand(1);
+    for (int n = 0; n < 2000; ++n) {
+        QByteArray data(rand() % 1000, 0);
+        for (int i = 0; i < data.size(); ++i) {
+            data[i] = char(rand());
+        }
+
+        SHA1 reference(false);
+        SHA1 sha;
+        for (int done = 0; done < data.size();) {
+            const int len = qMin(1 + rand() % 200, data.size() - done);
+            reference.process(data.constData() + done, len);
+            sha.process(data.constData() + done, len);
+            done += len;
+        }
+        if (memcmp(reference.hash(), sha.hash(), 20) != 0) {
+            printf("Error: the digests of %d bytes differ.\n", data.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void benchmark()
+{
+    const QByteArray data(64 * 1024 * 1024, 'x');
+    QElapsedTimer timer;
+
+    for (int accelerated = 0; accelerated < 2; ++accelerated) {
+        SHA1 sha(accelerated);
+        timer.start();
+        sha.process(data.constData(), data.size());
+        sha.hash();
+        printf("%s: %lld MiB/s\n", sha.isAccelerated() ? "SHA extensions" : "reference", qint64(64) * 1000 / qMax<qint64>(timer.elapsed(), 1));
+    }
+}
+
 int main()
 {
+    if (!check()) {
+        return -1;
+    }
+    printf("Digests match the reference implementation.\n");
+    benchmark();
+
     SHA1 *sha1;
     unsigned char data[] = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
     unsigned long et[] = {0x11223344};
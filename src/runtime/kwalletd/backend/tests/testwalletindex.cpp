@@ -0,0 +1,145 @@
+#include "kwalletbackend.h"
+#include "kwalletentry.h"
+#include "kwalletindex.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+#include <stdio.h>
+
+using namespace KWallet;
+
+static const QString walletPath = QStringLiteral("testwalletindex.kwl");
+
+static QString folderName(int i)
+{
+    return QStringLiteral("Folder %1").arg(i);
+}
+
+static QString keyName(int i)
+{
+    return QStringLiteral("https://example.org/account/%1").arg(i);
+}
+
+static void writeEntry(Backend &b, int i)
+{
+    Entry e;
+    e.setKey(keyName(i));
+    e.setType(Wallet::Password);
+    e.setValue(QByteArray("secret"));
+    b.setFolder(folderName(i % 4));
+    b.writeEntry(&e);
+}
+
+// The index has to give the same answers as the digests of a wallet
+// opened without the password.
+static bool compare(WalletIndex &index, const char *step)
+{
+    if (!index.update()) {
+        printf("Error: the index can't be read after %s.\n", step);
+        return false;
+    }
+
+    Backend b(walletPath, true);
+    b.open(QByteArray());
+    for (int f = 0; f < 6; ++f) {
+        if (index.folderDoesNotExist(folderName(f)) != b.folderDoesNotExist(folderName(f))) {
+            printf("Error: folder %d differs after %s.\n", f, step);
+            return false;
+        }
+        for (int i = 0; i < 40; ++i) {
+            if (index.entryDoesNotExist(folderName(f), keyName(i)) != b.entryDoesNotExist(folderName(f), keyName(i))) {
+                printf("Error: entry %d of folder %d differs after %s.\n", i, f, step);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool check()
+{
+    QFile::remove(walletPath);
+    WalletIndex index(walletPath, true);
+    if (index.update()) {
+        printf("Error: the index of a missing wallet can be read.\n");
+        return false;
+    }
+
+    {
+        Backend b(walletPath, true);
+        b.setCipherType(BACKEND_CIPHER_BLOWFISH);
+        b.open(QByteArray("password"));
+        for (int i = 0; i < 20; ++i) {
+            writeEntry(b, i);
+        }
+        b.close(true);
+    }
+    if (!compare(index, "writing the wallet")) {
+        return false;
+    }
+
+    // these go to the journal
+    {
+        Backend b(walletPath, true);
+        b.open(QByteArray("password"));
+        for (int i = 20; i < 30; ++i) {
+            writeEntry(b, i);
+        }
+        b.setFolder(folderName(1));
+        b.removeEntry(keyName(1));
+        b.renameEntry(keyName(5), keyName(35));
+        b.removeFolder(folderName(2));
+        b.createFolder(folderName(5));
+        b.close(true);
+    }
+    if (!compare(index, "appending to the journal")) {
+        return false;
+    }
+
+    {
+        Backend b(walletPath, true);
+        b.open(QByteArray("password"));
+        b.compact(0);
+        b.close(false);
+    }
+    return compare(index, "compacting the wallet");
+}
+
+// Queries per second for a closed wallet, opening it vs. the index.
+static void benchmark()
+{
+    const int opens = 20;
+    const int lookups = 10000;
+    int found = 0;
+    QElapsedTimer timer;
+
+    timer.start();
+    for (int i = 0; i < opens; ++i) {
+        Backend b(walletPath, true);
+        b.open(QByteArray());
+        found += !b.entryDoesNotExist(folderName(3), keyName(3));
+    }
+    const qint64 openTime = qMax<qint64>(timer.elapsed(), 1);
+
+    WalletIndex index(walletPath, true);
+    timer.start();
+    for (int i = 0; i < lookups; ++i) {
+        found += index.update() && !index.entryDoesNotExist(folderName(3), keyName(3));
+    }
+    const qint64 indexTime = qMax<qint64>(timer.elapsed(), 1);
+
+    printf("Backend::open() %lld queries/s, WalletIndex %lld queries/s (%d found)\n", opens * 1000LL / openTime, lookups * 1000LL / indexTime, found);
+}
+
+int main()
+{
+    if (!check()) {
+        return -1;
+    }
+    printf("Wallet index matches the backend.\n");
+
+    benchmark();
+    QFile::remove(walletPath);
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include <KSharedConfig>
 #include <KToolInvocation>
 #include <kwalletentry.h>
+#include <kwalletsyncjob.h>
 #include <kwindowsystem.h>
 #ifdef HAVE_GPGMEPP
 #include <gpgme++/key.h>
@@ -38,11 +39,15 @@
 #include <QApplication>
 #include <QDir>
 #include <QIcon>
+#include <QRunnable>
+#include <QSet>
+#include <QThreadPool>
 #include <QTimer>
 
 #include <assert.h>
 
 #include "kwalletadaptor.h"
+#include "kwalletfd_p.h"
 
 class KWalletTransaction
 {
@@ -90,10 +95,46 @@ private:
 
 int KWalletTransaction::nextTransactionId = 0;
 
+// The answer to a read, made on the worker thread of the wallet, see
+// KWalletD::replyLater(). A read dropped before it ran, as the wallet was
+// closed, gets an error instead of leaving the client waiting.
+class KWalletReadReply : public QRunnable
+{
+public:
+    KWalletReadReply(const QDBusMessage &msg, const QDBusConnection &conn, const std::function<QVariantList()> &arguments)
+        : message(msg)
+        , connection(conn)
+        , arguments(arguments)
+    {
+    }
+
+    ~KWalletReadReply() override
+    {
+        if (!replied) {
+            connection.send(message.createErrorReply(QDBusError::Failed, QStringLiteral("The wallet was closed")));
+        }
+    }
+
+    void run() override
+    {
+        connection.send(message.createReply(arguments()));
+        replied = true;
+    }
+
+private:
+    QDBusMessage message;
+    QDBusConnection connection;
+    std::function<QVariantList()> arguments;
+    bool replied = false;
+};
+
 KWalletD::KWalletD()
     : QObject(nullptr)
     , _failed(0)
     , _syncTime(5000)
+    , _maxSyncDelay(30000)
+    , _maxPendingChanges(100)
+    , _compactTime(30000)
     , _curtrans(nullptr)
     , _useGpg(false)
 {
@@ -107,6 +148,7 @@ KWalletD::KWalletD()
     _idleTime = 0;
     connect(&_closeTimers, SIGNAL(timedOut(int)), this, SLOT(timedOutClose(int)));
     connect(&_syncTimers, SIGNAL(timedOut(int)), this, SLOT(timedOutSync(int)));
+    connect(&_compactTimers, SIGNAL(timedOut(int)), this, SLOT(timedOutCompact(int)));
 
     (void)new KWalletAdaptor(this);
     // register services
@@ -845,6 +887,7 @@ int KWalletD::deleteWallet(const QString &wallet)
         const QPair<int, KWallet::Backend *> walletInfo = findWallet(wallet);
         internalClose(walletInfo.second, walletInfo.first, true);
         QFile::remove(path);
+        _indexes.remove(wallet);
         Q_EMIT walletDeleted(wallet);
         // also delete access control entries
         KConfigGroup cfgAllow = KSharedConfig::openConfig(QStringLiteral("kwalletrc"))->group("Auto Allow");
@@ -887,9 +930,24 @@ void KWalletD::changePassword(const QString &wallet, qlonglong wId, const QStrin
 
 void KWalletD::initiateSync(int handle)
 {
+    // Changes are written together once things calmed down, but a steady
+    // stream of them can't hold the sync off for more than _maxSyncDelay,
+    // nor pile up past _maxPendingChanges.
+    KWallet::Backend *b = _wallets.value(handle);
+    if (b && !b->syncJob() && b->pendingChanges() >= quint64(_maxPendingChanges)) {
+        timedOutSync(handle);
+        return;
+    }
+
+    QHash<int, QDeadlineTimer>::iterator deadline = _syncDeadlines.find(handle);
+    if (deadline == _syncDeadlines.end()) {
+        deadline = _syncDeadlines.insert(handle, QDeadlineTimer(_maxSyncDelay));
+    }
+    const int timeout = int(qMin<qint64>(_syncTime, deadline->remainingTime()));
+
     // add a timer and reset it right away
-    _syncTimers.addTimer(handle, _syncTime);
-    _syncTimers.resetTimer(handle, _syncTime);
+    _syncTimers.addTimer(handle, timeout);
+    _syncTimers.resetTimer(handle, timeout);
 }
 
 void KWalletD::doTransactionChangePassword(const QString &appid, const QString &wallet, qlonglong wId)
@@ -980,7 +1038,18 @@ int KWalletD::internalClose(KWallet::Backend *const w, const int handle, const b
                 _closeTimers.removeTimer(handle);
             }
             _syncTimers.removeTimer(handle);
+            _syncDeadlines.remove(handle);
+            _compactTimers.removeTimer(handle);
             _wallets.remove(handle);
+            // The reads not started yet are answered with an error. The
+            // pool deletes itself once the one running is done, so the
+            // calls to the other wallets don't wait for it.
+            if (QThreadPool *worker = _workers.take(handle)) {
+                worker->clear();
+                worker->start([worker]() {
+                    worker->deleteLater();
+                });
+            }
             w->close(saveBeforeClose);
             doCloseSignals(handle, wallet);
             delete w;
@@ -1060,21 +1129,114 @@ void KWalletD::sync(int handle, const QString &appid)
 
     // get the wallet and check if we have a password for it (safety measure)
     if ((b = getWallet(appid, handle))) {
-        QString wallet = b->walletName();
+        // Unlike the timed syncs, this one returns once the changes are on
+        // disk. Backend::sync() waits for a write still running first.
         b->sync(0);
+        syncFinished(handle, nullptr);
     }
 }
 
 void KWalletD::timedOutSync(int handle)
 {
     _syncTimers.removeTimer(handle);
+    _syncDeadlines.remove(handle);
     if (_wallets.contains(handle) && _wallets[handle]) {
-        _wallets[handle]->sync(0);
+        syncInBackground(handle, false);
     } else {
         qDebug("wallet not found for sync!");
     }
 }
 
+void KWalletD::timedOutCompact(int handle)
+{
+    _compactTimers.removeTimer(handle);
+    if (_wallets.contains(handle) && _wallets[handle]) {
+        syncInBackground(handle, true);
+    } else {
+        qDebug("wallet not found for compaction!");
+    }
+}
+
+void KWalletD::syncInBackground(int handle, bool compact)
+{
+    KWallet::Backend *b = _wallets.value(handle);
+
+    if (b->syncJob()) {
+        // one write at a time, try again later
+        if (compact) {
+            _compactTimers.addTimer(handle, _compactTime);
+        } else {
+            initiateSync(handle);
+        }
+        return;
+    }
+
+    if (!b->syncsInBackground()) {
+        if (compact) {
+            b->compact(0);
+        } else {
+            b->sync(0);
+        }
+        syncFinished(handle, nullptr);
+        return;
+    }
+
+    // The file is encrypted and written on another thread, so the calls
+    // to the other wallets don't wait for the disk.
+    KWallet::SyncJob *job = b->startSync(compact);
+    if (job) {
+        connect(job, &KWallet::SyncJob::finished, this, [this, handle, job]() {
+            syncFinished(handle, job);
+        });
+    }
+}
+
+void KWalletD::syncFinished(int handle, KWallet::SyncJob *job)
+{
+    KWallet::Backend *b = _wallets.value(handle);
+    if (!b || b->syncJob() != job) {
+        return; // closed meanwhile, which took the result in
+    }
+
+    // a record that couldn't be appended leaves the wallet to be rewritten
+    const bool appendsOnly = job && job->appendsOnly();
+    if (b->finishSync() != 0 && appendsOnly) {
+        initiateSync(handle);
+    }
+    // fold the appended changes into the wallet file once things calmed down
+    if (b->needsCompaction()) {
+        _compactTimers.addTimer(handle, _compactTime);
+    }
+}
+
+template<typename T, typename Read>
+T KWalletD::replyLater(int handle, Read read)
+{
+    if (!calledFromDBus()) {
+        return read();
+    }
+
+    replyLater(handle, [read]() {
+        return QVariantList{QVariant::fromValue(read())};
+    });
+    return T();
+}
+
+void KWalletD::replyLater(int handle, const std::function<QVariantList()> &arguments)
+{
+    // The main thread goes on with the dialogs and the calls to the other
+    // wallets meanwhile. One thread per wallet, so that the reads of a
+    // client are answered in the order they were made.
+    QThreadPool *&worker = _workers[handle];
+    if (!worker) {
+        worker = new QThreadPool(this);
+        worker->setMaxThreadCount(1);
+    }
+
+    setDelayedReply(true);
+    worker->start(new KWalletReadReply(message(), connection(), arguments));
+}
+
 void KWalletD::doTransactionOpenCancelled(const QString &appid, const QString &wallet, const QString &service)
 {
     // there will only be one session left to remove - all others
@@ -1152,10 +1314,14 @@ QByteArray KWalletD::readMap(int handle, const QString &folder, const QString &k
 
     if ((b = getWallet(appid, handle))) {
         b->setFolder(folder);
-        KWallet::Entry *e = b->readEntry(key);
-        if (e && e->type() == KWallet::Wallet::Map) {
-            return e->map();
-        }
+        const KWallet::Contents contents = b->contents();
+        return replyLater<QByteArray>(handle, [contents, folder, key]() {
+            const KWallet::Contents::Item *item = contents.entry(folder, key);
+            if (item && item->type() == KWallet::Wallet::Map) {
+                return item->value();
+            }
+            return QByteArray();
+        });
     }
 
     return QByteArray();
@@ -1184,20 +1350,24 @@ QVariantMap KWalletD::readMapList(int handle, const QString &folder, const QStri
 
 QVariantMap KWalletD::mapList(int handle, const QString &folder, const QString &appid)
 {
-    QVariantMap rc;
-
     KWallet::Backend *backend = getWallet(appid, handle);
     if (backend) {
         backend->setFolder(folder);
-        const QList<KWallet::Entry *> lst = backend->entriesList();
-        for (KWallet::Entry *entry : lst) {
-            if (entry->type() == KWallet::Wallet::Map) {
-                rc.insert(entry->key(), entry->map());
+        const KWallet::Contents contents = backend->contents();
+        return replyLater<QVariantMap>(handle, [contents, folder]() {
+            QVariantMap rc;
+            const QStringList keys = contents.entryList(folder);
+            for (const QString &key : keys) {
+                const KWallet::Contents::Item *item = contents.entry(folder, key);
+                if (item->type() == KWallet::Wallet::Map) {
+                    rc.insert(key, item->value());
+                }
             }
-        }
+            return rc;
+        });
     }
 
-    return rc;
+    return QVariantMap();
 }
 
 QByteArray KWalletD::readEntry(int handle, const QString &folder, const QString &key, const QString &appid)
@@ -1206,15 +1376,74 @@ QByteArray KWalletD::readEntry(int handle, const QString &folder, const QString
 
     if ((b = getWallet(appid, handle))) {
         b->setFolder(folder);
-        KWallet::Entry *e = b->readEntry(key);
-        if (e) {
-            return e->value();
-        }
+        const KWallet::Contents contents = b->contents();
+        return replyLater<QByteArray>(handle, [contents, folder, key]() {
+            const KWallet::Contents::Item *item = contents.entry(folder, key);
+            return item ? item->value() : QByteArray();
+        });
     }
 
     return QByteArray();
 }
 
+QDBusVariant KWalletD::readEntryFd(int handle, const QString &folder, const QString &key, const QString &appid)
+{
+    KWallet::Backend *b;
+
+    if ((b = getWallet(appid, handle))) {
+        b->setFolder(folder);
+        const KWallet::Contents contents = b->contents();
+        const bool fdPassing = !calledFromDBus() || (connection().connectionCapabilities() & QDBusConnection::UnixFileDescriptorPassing);
+        return replyLater<QDBusVariant>(handle, [contents, folder, key, fdPassing]() {
+            const KWallet::Contents::Item *item = contents.entry(folder, key);
+            const QByteArray value = item ? item->value() : QByteArray();
+            if (fdPassing && value.size() >= KWallet::FdThreshold) {
+                const QDBusUnixFileDescriptor fd = KWallet::valueToFd(value);
+                if (fd.isValid()) {
+                    return QDBusVariant(QVariant::fromValue(fd));
+                }
+            }
+            return QDBusVariant(value);
+        });
+    }
+
+    return QDBusVariant(QByteArray());
+}
+
+bool KWalletD::readEntryTyped(int handle, const QString &folder, const QString &key, const QString &appid, int &entryType, QByteArray &value)
+{
+    KWallet::Backend *b;
+
+    entryType = KWallet::Wallet::Unknown;
+    if (!(b = getWallet(appid, handle))) {
+        return false;
+    }
+
+    // decrypts it if needed
+    if (b->hasFolder(folder)) {
+        b->setFolder(folder);
+    }
+
+    const KWallet::Contents contents = b->contents();
+    const auto read = [contents, folder, key](int &entryType, QByteArray &value) {
+        const KWallet::Contents::Item *item = contents.entry(folder, key);
+        entryType = item ? item->type() : KWallet::Wallet::Unknown;
+        value = item ? item->value() : QByteArray();
+        return item != nullptr;
+    };
+
+    if (!calledFromDBus()) {
+        return read(entryType, value);
+    }
+    replyLater(handle, [read]() {
+        int entryType;
+        QByteArray value;
+        const bool exists = read(entryType, value);
+        return QVariantList{exists, entryType, value};
+    });
+    return false;
+}
+
 #if KWALLET_BUILD_DEPRECATED_SINCE(5, 72)
 QVariantMap KWalletD::readEntryList(int handle, const QString &folder, const QString &key, const QString &appid)
 {
@@ -1236,18 +1465,21 @@ QVariantMap KWalletD::readEntryList(int handle, const QString &folder, const QSt
 
 QVariantMap KWalletD::entriesList(int handle, const QString &folder, const QString &appid)
 {
-    QVariantMap rc;
-
     KWallet::Backend *backend = getWallet(appid, handle);
     if (backend) {
         backend->setFolder(folder);
-        const QList<KWallet::Entry *> lst = backend->entriesList();
-        for (KWallet::Entry *entry : lst) {
-            rc.insert(entry->key(), entry->value());
-        }
+        const KWallet::Contents contents = backend->contents();
+        return replyLater<QVariantMap>(handle, [contents, folder]() {
+            QVariantMap rc;
+            const QStringList keys = contents.entryList(folder);
+            for (const QString &key : keys) {
+                rc.insert(key, contents.entry(folder, key)->value());
+            }
+            return rc;
+        });
     }
 
-    return rc;
+    return QVariantMap();
 }
 
 QStringList KWalletD::entryList(int handle, const QString &folder, const QString &appid)
@@ -1256,7 +1488,10 @@ QStringList KWalletD::entryList(int handle, const QString &folder, const QString
 
     if ((b = getWallet(appid, handle))) {
         b->setFolder(folder);
-        return b->entryList();
+        const KWallet::Contents contents = b->contents();
+        return replyLater<QStringList>(handle, [contents, folder]() {
+            return contents.entryList(folder);
+        });
     }
 
     return QStringList();
@@ -1268,10 +1503,14 @@ QString KWalletD::readPassword(int handle, const QString &folder, const QString
 
     if ((b = getWallet(appid, handle))) {
         b->setFolder(folder);
-        KWallet::Entry *e = b->readEntry(key);
-        if (e && e->type() == KWallet::Wallet::Password) {
-            return e->password();
-        }
+        const KWallet::Contents contents = b->contents();
+        return replyLater<QString>(handle, [contents, folder, key]() {
+            const KWallet::Contents::Item *item = contents.entry(folder, key);
+            if (item && item->type() == KWallet::Wallet::Password) {
+                return item->password();
+            }
+            return QString();
+        });
     }
 
     return QString();
@@ -1300,20 +1539,24 @@ QVariantMap KWalletD::readPasswordList(int handle, const QString &folder, const
 
 QVariantMap KWalletD::passwordList(int handle, const QString &folder, const QString &appid)
 {
-    QVariantMap rc;
-
     KWallet::Backend *backend = getWallet(appid, handle);
     if (backend) {
         backend->setFolder(folder);
-        const QList<KWallet::Entry *> lst = backend->entriesList();
-        for (KWallet::Entry *entry : lst) {
-            if (entry->type() == KWallet::Wallet::Password) {
-                rc.insert(entry->key(), entry->password());
+        const KWallet::Contents contents = backend->contents();
+        return replyLater<QVariantMap>(handle, [contents, folder]() {
+            QVariantMap rc;
+            const QStringList keys = contents.entryList(folder);
+            for (const QString &key : keys) {
+                const KWallet::Contents::Item *item = contents.entry(folder, key);
+                if (item->type() == KWallet::Wallet::Password) {
+                    rc.insert(key, item->password());
+                }
             }
-        }
+            return rc;
+        });
     }
 
-    return rc;
+    return QVariantMap();
 }
 
 int KWalletD::writeMap(int handle, const QString &folder, const QString &key, const QByteArray &value, const QString &appid)
@@ -1326,7 +1569,9 @@ int KWalletD::writeMap(int handle, const QString &folder, const QString &key, co
         e.setKey(key);
         e.setValue(value);
         e.setType(KWallet::Wallet::Map);
-        b->writeEntry(&e);
+        if (!b->writeEntry(&e)) {
+            return -1;
+        }
         initiateSync(handle);
         emitFolderUpdated(b->walletName(), folder);
         return 0;
@@ -1345,7 +1590,9 @@ int KWalletD::writeEntry(int handle, const QString &folder, const QString &key,
         e.setKey(key);
         e.setValue(value);
         e.setType(KWallet::Wallet::EntryType(entryType));
-        b->writeEntry(&e);
+        if (!b->writeEntry(&e)) {
+            return -1;
+        }
         initiateSync(handle);
         emitFolderUpdated(b->walletName(), folder);
         return 0;
@@ -1364,7 +1611,34 @@ int KWalletD::writeEntry(int handle, const QString &folder, const QString &key,
         e.setKey(key);
         e.setValue(value);
         e.setType(KWallet::Wallet::Stream);
-        b->writeEntry(&e);
+        if (!b->writeEntry(&e)) {
+            return -1;
+        }
+        initiateSync(handle);
+        emitFolderUpdated(b->walletName(), folder);
+        return 0;
+    }
+
+    return -1;
+}
+
+int KWalletD::writeEntryFd(int handle, const QString &folder, const QString &key, const QDBusUnixFileDescriptor &value, int entryType, const QString &appid)
+{
+    KWallet::Backend *b;
+
+    if ((b = getWallet(appid, handle))) {
+        QByteArray data;
+        if (!KWallet::valueFromFd(value, data)) {
+            return -2;
+        }
+        b->setFolder(folder);
+        KWallet::Entry e;
+        e.setKey(key);
+        e.setValue(data);
+        e.setType(KWallet::Wallet::EntryType(entryType));
+        if (!b->writeEntry(&e)) {
+            return -1;
+        }
         initiateSync(handle);
         emitFolderUpdated(b->walletName(), folder);
         return 0;
@@ -1383,7 +1657,9 @@ int KWalletD::writePassword(int handle, const QString &folder, const QString &ke
         e.setKey(key);
         e.setValue(value);
         e.setType(KWallet::Wallet::Password);
-        b->writeEntry(&e);
+        if (!b->writeEntry(&e)) {
+            return -1;
+        }
         initiateSync(handle);
         emitFolderUpdated(b->walletName(), folder);
         return 0;
@@ -1401,9 +1677,11 @@ int KWalletD::entryType(int handle, const QString &folder, const QString &key, c
             return KWallet::Wallet::Unknown;
         }
         b->setFolder(folder);
-        if (b->hasEntry(key)) {
-            return b->readEntry(key)->type();
-        }
+        const KWallet::Contents contents = b->contents();
+        return replyLater<int>(handle, [contents, folder, key]() {
+            const KWallet::Contents::Item *item = contents.entry(folder, key);
+            return int(item ? item->type() : KWallet::Wallet::Unknown);
+        });
     }
 
     return KWallet::Wallet::Unknown;
@@ -1418,7 +1696,10 @@ bool KWalletD::hasEntry(int handle, const QString &folder, const QString &key, c
             return false;
         }
         b->setFolder(folder);
-        return b->hasEntry(key);
+        const KWallet::Contents contents = b->contents();
+        return replyLater<bool>(handle, [contents, folder, key]() {
+            return contents.entry(folder, key) != nullptr;
+        });
     }
 
     return false;
@@ -1433,6 +1714,9 @@ int KWalletD::removeEntry(int handle, const QString &folder, const QString &key,
             return 0;
         }
         b->setFolder(folder);
+        if (b->isFolderEncrypted(folder)) {
+            return -1;
+        }
         bool rc = b->removeEntry(key);
         initiateSync(handle);
         emitFolderUpdated(b->walletName(), folder);
@@ -1442,6 +1726,140 @@ int KWalletD::removeEntry(int handle, const QString &folder, const QString &key,
     return -1;
 }
 
+QList<int> KWalletD::readEntries(int handle, const QStringList &folders, const QStringList &keys, const QString &appid, QVariantList &values)
+{
+    KWallet::Backend *b;
+
+    if (folders.count() != keys.count() || !(b = getWallet(appid, handle))) {
+        return QList<int>();
+    }
+
+    // decrypts them if needed
+    const QSet<QString> folderSet(folders.constBegin(), folders.constEnd());
+    for (const QString &folder : folderSet) {
+        if (b->hasFolder(folder)) {
+            b->setFolder(folder);
+        }
+    }
+
+    const KWallet::Contents contents = b->contents();
+    const auto read = [contents, folders, keys](QVariantList &values) {
+        QList<int> types;
+        types.reserve(keys.count());
+        values.reserve(keys.count());
+        for (int i = 0; i < keys.count(); ++i) {
+            const KWallet::Contents::Item *item = contents.entry(folders.at(i), keys.at(i));
+            types.append(item ? item->type() : KWallet::Wallet::Unknown);
+            values.append(item ? item->value() : QByteArray());
+        }
+        return types;
+    };
+
+    if (!calledFromDBus()) {
+        return read(values);
+    }
+    replyLater(handle, [read]() {
+        QVariantList values;
+        const QList<int> types = read(values);
+        return QVariantList{QVariant::fromValue(types), QVariant(values)};
+    });
+    return QList<int>();
+}
+
+int KWalletD::writeEntries(int handle,
+                           const QStringList &folders,
+                           const QStringList &keys,
+                           const QVariantList &values,
+                           const QList<int> &entryTypes,
+                           const QString &appid)
+{
+    KWallet::Backend *b;
+
+    if (!(b = getWallet(appid, handle))) {
+        return -1;
+    }
+
+    // check everything first, so that it's all or nothing
+    const int count = keys.count();
+    if (folders.count() != count || values.count() != count || entryTypes.count() != count) {
+        return -2;
+    }
+    for (int i = 0; i < count; ++i) {
+        const int type = entryTypes.at(i);
+        if (type < KWallet::Wallet::Password || type > KWallet::Wallet::Map || values.at(i).userType() != QMetaType::QByteArray) {
+            return -2;
+        }
+    }
+    const QSet<QString> changed(folders.cbegin(), folders.cend());
+    for (const QString &folder : changed) {
+        // a folder which couldn't be decrypted can't be written to
+        if (b->hasFolder(folder)) {
+            b->setFolder(folder);
+            if (b->isFolderEncrypted(folder)) {
+                return -1;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        b->setFolder(folders.at(i));
+        KWallet::Entry e;
+        e.setKey(keys.at(i));
+        e.setValue(values.at(i).toByteArray());
+        e.setType(KWallet::Wallet::EntryType(entryTypes.at(i)));
+        b->writeEntry(&e);
+    }
+
+    if (count > 0) {
+        initiateSync(handle);
+    }
+    for (const QString &folder : qAsConst(changed)) {
+        emitFolderUpdated(b->walletName(), folder);
+    }
+    return 0;
+}
+
+QList<int> KWalletD::removeEntries(int handle, const QStringList &folders, const QStringList &keys, const QString &appid)
+{
+    QList<int> rc;
+    KWallet::Backend *b;
+
+    if (folders.count() != keys.count()) {
+        return rc;
+    }
+    rc.reserve(keys.count());
+    if (!(b = getWallet(appid, handle))) {
+        for (int i = 0; i < keys.count(); ++i) {
+            rc.append(-1);
+        }
+        return rc;
+    }
+
+    QSet<QString> changed;
+    for (int i = 0; i < keys.count(); ++i) {
+        const QString &folder = folders.at(i);
+        if (!b->hasFolder(folder)) {
+            rc.append(0);
+            continue;
+        }
+        b->setFolder(folder);
+        if (b->isFolderEncrypted(folder)) {
+            rc.append(-1);
+            continue;
+        }
+        rc.append(b->removeEntry(keys.at(i)) ? 0 : -3);
+        changed.insert(folder);
+    }
+
+    if (!changed.isEmpty()) {
+        initiateSync(handle);
+    }
+    for (const QString &folder : qAsConst(changed)) {
+        emitFolderUpdated(b->walletName(), folder);
+    }
+    return rc;
+}
+
 void KWalletD::slotServiceOwnerChanged(const QString &name, const QString &oldOwner, const QString &newOwner)
 {
     Q_UNUSED(name);
@@ -1613,6 +2031,10 @@ void KWalletD::reconfigure()
     int timeSave = _idleTime;
     // in minutes!
     _idleTime = walletGroup.readEntry("Idle Timeout", 10) * 60 * 1000;
+    // in seconds
+    _syncTime = walletGroup.readEntry("Sync Delay", 5) * 1000;
+    _maxSyncDelay = qMax(_syncTime, walletGroup.readEntry("Max Sync Delay", 30) * 1000);
+    _maxPendingChanges = qMax(1, walletGroup.readEntry("Max Unsaved Changes", 100));
 #ifdef Q_WS_X11
     if (walletGroup.readEntry("Close on Screensaver", false)) {
         // BUG 254273 : if kwalletd starts before the screen saver, then the
@@ -1691,6 +2113,11 @@ bool KWalletD::folderDoesNotExist(const QString &wallet, const QString &folder)
         return walletInfo.second->folderDoesNotExist(folder);
     }
 
+    KWallet::WalletIndex *index = walletIndex(wallet);
+    if (index) {
+        return index->folderDoesNotExist(folder);
+    }
+
     KWallet::Backend *b = new KWallet::Backend(wallet);
     b->open(QByteArray());
     bool rc = b->folderDoesNotExist(folder);
@@ -1709,6 +2136,11 @@ bool KWalletD::keyDoesNotExist(const QString &wallet, const QString &folder, con
         return walletInfo.second->entryDoesNotExist(folder, key);
     }
 
+    KWallet::WalletIndex *index = walletIndex(wallet);
+    if (index) {
+        return index->entryDoesNotExist(folder, key);
+    }
+
     KWallet::Backend *b = new KWallet::Backend(wallet);
     b->open(QByteArray());
     bool rc = b->entryDoesNotExist(folder, key);
@@ -1716,6 +2148,15 @@ bool KWalletD::keyDoesNotExist(const QString &wallet, const QString &folder, con
     return rc;
 }
 
+KWallet::WalletIndex *KWalletD::walletIndex(const QString &wallet)
+{
+    QHash<QString, KWallet::WalletIndex>::iterator i = _indexes.find(wallet);
+    if (i == _indexes.end()) {
+        i = _indexes.insert(wallet, KWallet::WalletIndex(wallet));
+    }
+    return i->update() ? &i.value() : nullptr;
+}
+
 bool KWalletD::implicitAllow(const QString &wallet, const QString &app)
 {
     return _implicitAllowMap[wallet].contains(app);
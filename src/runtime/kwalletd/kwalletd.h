@@ -10,11 +10,14 @@
 #define _KWALLETD_H_
 
 #include "kwalletbackend.h"
+#include "kwalletindex.h"
 #include <QDBusServiceWatcher>
+#include <QDeadlineTimer>
 #include <QHash>
 #include <QPointer>
 #include <QString>
 #include <QtDBus>
+#include <functional>
 #include <stdlib.h>
 #include <time.h>
 
@@ -23,6 +26,7 @@
 
 class KDirWatch;
 class KTimeout;
+class QThreadPool;
 
 // @Private
 class KWalletTransaction;
@@ -99,6 +103,9 @@ public Q_SLOTS:
     QByteArray readEntry(int handle, const QString &folder, const QString &key, const QString &appid);
     QByteArray readMap(int handle, const QString &folder, const QString &key, const QString &appid);
     QString readPassword(int handle, const QString &folder, const QString &key, const QString &appid);
+    // As readEntry(), but large values come in a memfd: the variant holds
+    // either the value or a file descriptor to read it from.
+    QDBusVariant readEntryFd(int handle, const QString &folder, const QString &key, const QString &appid);
 
 #if KWALLET_BUILD_DEPRECATED_SINCE(5, 72)
     // use entriesList()
@@ -127,6 +134,9 @@ public Q_SLOTS:
     int writeEntry(int handle, const QString &folder, const QString &key, const QByteArray &value, const QString &appid);
     int writeMap(int handle, const QString &folder, const QString &key, const QByteArray &value, const QString &appid);
     int writePassword(int handle, const QString &folder, const QString &key, const QString &value, const QString &appid);
+    // As writeEntry(), reading the value from a memfd or regular file.
+    // rc=-2 if it can't be read.
+    int writeEntryFd(int handle, const QString &folder, const QString &key, const QDBusUnixFileDescriptor &value, int entryType, const QString &appid);
 
     // Does the entry exist?
     bool hasEntry(int handle, const QString &folder, const QString &key, const QString &appid);
@@ -134,9 +144,28 @@ public Q_SLOTS:
     // What type is the entry?
     int entryType(int handle, const QString &folder, const QString &key, const QString &appid);
 
+    // Whether an entry exists, with its type and value, all in one call.
+    // Unlike the other calls it doesn't create the folder.
+    bool readEntryTyped(int handle, const QString &folder, const QString &key, const QString &appid, int &entryType, QByteArray &value);
+
     // Remove an entry.  rc=0 on success.
     int removeEntry(int handle, const QString &folder, const QString &key, const QString &appid);
 
+    // The same for many entries in one call, entry i being keys[i] in
+    // folders[i]. readEntries() gives the type of each entry, Unknown if it
+    // doesn't exist, and its value. writeEntries() makes all the changes or,
+    // if an argument is wrong or a folder can't be decrypted, none: rc=0 on
+    // success, -2 for bad arguments, -1 otherwise.
+    // removeEntries() gives the rc of removeEntry() for each entry.
+    QList<int> readEntries(int handle, const QStringList &folders, const QStringList &keys, const QString &appid, QVariantList &values);
+    int writeEntries(int handle,
+                     const QStringList &folders,
+                     const QStringList &keys,
+                     const QVariantList &values,
+                     const QList<int> &entryTypes,
+                     const QString &appid);
+    QList<int> removeEntries(int handle, const QStringList &folders, const QStringList &keys, const QString &appid);
+
     // Disconnect an app from a wallet
     bool disconnectApplication(const QString &wallet, const QString &application);
 
@@ -183,6 +212,7 @@ private Q_SLOTS:
     void emitWalletListDirty();
     void timedOutClose(int handle);
     void timedOutSync(int handle);
+    void timedOutCompact(int handle);
     void notifyFailures();
     void processTransactions();
     void activatePasswordDialog();
@@ -213,14 +243,31 @@ private:
     void doTransactionOpenCancelled(const QString &appid, const QString &wallet, const QString &service);
     int doTransactionOpen(const QString &appid, const QString &wallet, bool isPath, qlonglong wId, bool modal, const QString &service);
     void initiateSync(int handle);
+    // Writes the wallet on a worker thread when it can, see
+    // KWallet::Backend::startSync().
+    void syncInBackground(int handle, bool compact);
+    void syncFinished(int handle, KWallet::SyncJob *job);
+    // Answers the D-Bus call being handled with what @p read returns, on
+    // the worker thread of the wallet. @p read must only use what it
+    // captured, e.g. a KWallet::Contents.
+    template<typename T, typename Read>
+    T replyLater(int handle, Read read);
+    // The same for replies made of several arguments.
+    void replyLater(int handle, const std::function<QVariantList()> &arguments);
 
     void setupDialog(QWidget *dialog, WId wId, const QString &appid, bool modal);
     void checkActiveDialog();
 
     QPair<int, KWallet::Backend *> findWallet(const QString &walletName) const;
+    // The digest table of a wallet which isn't open, or null if it has to
+    // be opened to find out what's in it.
+    KWallet::WalletIndex *walletIndex(const QString &wallet);
 
     typedef QHash<int, KWallet::Backend *> Wallets;
     Wallets _wallets;
+    // Handle->thread answering the reads of the wallet
+    QHash<int, QThreadPool *> _workers;
+    QHash<QString, KWallet::WalletIndex> _indexes;
     KDirWatch *_dw;
     int _failed;
 
@@ -231,7 +278,13 @@ private:
     QMap<QString, QStringList> _implicitAllowMap, _implicitDenyMap;
     KTimeout _closeTimers;
     KTimeout _syncTimers;
-    const int _syncTime;
+    KTimeout _compactTimers;
+    // when the changes made since the last sync have to be written
+    QHash<int, QDeadlineTimer> _syncDeadlines;
+    int _syncTime; // quiet period after a change
+    int _maxSyncDelay;
+    int _maxPendingChanges;
+    const int _compactTime;
     static bool _processing;
 
     KWalletTransaction *_curtrans; // current transaction
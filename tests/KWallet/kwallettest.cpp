@@ -7,6 +7,7 @@
 
 #include "kwallettest.h"
 
+#include <QDataStream>
 #include <QTest>
 #include <qglobal.h>
 
@@ -21,6 +22,34 @@ void KWalletTest::init()
     }
 }
 
+void KWalletTest::cleanup()
+{
+    if (m_wallet) {
+        m_wallet->removeFolder(m_folder);
+        delete m_wallet;
+        m_wallet = nullptr;
+        Wallet::closeWallet(QStringLiteral("kdewallet"), true);
+    }
+    m_folder.clear();
+}
+
+// Opens the wallet with @p folder as the current folder, which cleanup()
+// removes again.
+bool KWalletTest::openTestFolder(const QString &folder)
+{
+    m_wallet = Wallet::openWallet(QStringLiteral("kdewallet"), 0, Wallet::Synchronous);
+    if (!m_wallet) {
+        qWarning() << "openWallet failed!";
+        return false;
+    }
+    m_folder = folder;
+    if (!m_wallet->createFolder(folder) || !m_wallet->setFolder(folder)) {
+        qWarning() << "Couldn't create the test folder" << folder;
+        return false;
+    }
+    return true;
+}
+
 void KWalletTest::testWallet()
 {
     QString testWallet = QStringLiteral("kdewallet");
@@ -100,4 +129,158 @@ void KWalletTest::testWallet()
     QVERIFY2(!Wallet::isOpen("kdewallet"), "Failed to close wallet");
 }
 
+void KWalletTest::testManyEntries()
+{
+    QVERIFY(openTestFolder(QStringLiteral("wallettestmany")));
+
+    QMap<QString, QByteArray> entries;
+    for (int i = 0; i < 100; i++) {
+        entries.insert(QStringLiteral("key%1").arg(i), QByteArray::number(i));
+    }
+    QVERIFY2(m_wallet->writeEntries(entries) == 0, "writeEntries failed!");
+
+    // the missing key is left out
+    bool ok = false;
+    QVERIFY2(m_wallet->readEntries(entries.keys() << "madeUpKey", &ok) == entries, "readEntries failed!");
+    QVERIFY2(ok, "readEntries failed!");
+
+    QMap<QString, QString> passwords;
+    passwords.insert("password", "secret");
+    QVERIFY2(m_wallet->writePasswords(passwords) == 0, "writePasswords failed!");
+    QString password;
+    m_wallet->readPassword("password", password);
+    QVERIFY2(password == "secret", "readPassword after writePasswords failed!");
+
+    QVERIFY2(m_wallet->removeEntries(entries.keys()) == 0, "removeEntries failed!");
+    QVERIFY2(m_wallet->readEntries(entries.keys(), &ok).isEmpty(), "entries left after removeEntries!");
+    QVERIFY2(m_wallet->removeEntries(entries.keys()) != 0, "removeEntries of missing entries succeeded!");
+}
+
+void KWalletTest::testLargeEntry()
+{
+    QVERIFY(openTestFolder(QStringLiteral("wallettestlarge")));
+
+    // big enough to go through a file descriptor
+    QByteArray value(4 * 1024 * 1024, 'k');
+    for (int i = 0; i < value.size(); i += 4099) {
+        value[i] = char(i);
+    }
+    QVERIFY2(m_wallet->writeEntry("large", value) == 0, "writeEntry of a large value failed!");
+    QByteArray readEntry;
+    QVERIFY2(m_wallet->readEntry("large", readEntry) == 0, "readEntry of a large value failed!");
+    QVERIFY2(readEntry == value, "large value read back differs!");
+}
+
+void KWalletTest::testFolderCache()
+{
+    QString testWallet = QStringLiteral("kdewallet");
+    QString testFolder = QStringLiteral("wallettestfolders");
+    QString otherFolder = QStringLiteral("wallettestotherfolder");
+
+    Wallet *wallet = Wallet::openWallet(testWallet, 0, Wallet::Synchronous);
+    QVERIFY2(wallet != nullptr, "openWallet failed!");
+
+    // from here on the folders are known without asking the wallet service
+    QVERIFY2(!wallet->hasFolder(testFolder), "testFolder exists already!");
+    QVERIFY2(wallet->createFolder(testFolder), "createFolder failed!");
+    QVERIFY2(wallet->hasFolder(testFolder), "created folder not found!");
+    QVERIFY2(wallet->setFolder(testFolder), "setFolder failed!");
+    QVERIFY2(wallet->removeFolder(testFolder), "removeFolder failed!");
+    QVERIFY2(!wallet->hasFolder(testFolder), "removed folder still found!");
+    QVERIFY2(!wallet->setFolder(testFolder), "setFolder to a removed folder succeeded!");
+
+    // the changes made through another object show up too
+    QVERIFY2(!wallet->hasFolder(otherFolder), "otherFolder exists already!");
+    Wallet *other = Wallet::openWallet(testWallet, 0, Wallet::Synchronous);
+    QVERIFY2(other != nullptr, "second openWallet failed!");
+    QVERIFY2(other->createFolder(otherFolder), "createFolder through the second object failed!");
+    QTRY_VERIFY2(wallet->hasFolder(otherFolder), "folder created through the second object not found!");
+    QVERIFY2(other->removeFolder(otherFolder), "removeFolder through the second object failed!");
+    QTRY_VERIFY2(!wallet->hasFolder(otherFolder), "folder removed through the second object still found!");
+
+    delete other;
+    delete wallet;
+    Wallet::closeWallet(testWallet, true);
+}
+
+void KWalletTest::testReadCache()
+{
+    QVERIFY(openTestFolder(QStringLiteral("wallettestcache")));
+    m_wallet->setReadCache(64 * 1024);
+
+    QVERIFY2(m_wallet->writePassword("cached", "first") == 0, "writePassword failed!");
+    QString password;
+    QVERIFY2(m_wallet->readPassword("cached", password) == 0 && password == QLatin1String("first"), "readPassword failed!");
+    QVERIFY2(m_wallet->readCacheMisses() == 1, "first read wasn't a miss!");
+    QVERIFY2(m_wallet->readPassword("cached", password) == 0 && password == QLatin1String("first"), "cached readPassword failed!");
+    QVERIFY2(m_wallet->readCacheHits() == 1, "second read wasn't a hit!");
+    QVERIFY2(m_wallet->entryType("cached") == Wallet::Password, "entryType failed!");
+
+    // own writes are seen at once
+    QVERIFY2(m_wallet->writePassword("cached", "second") == 0, "writePassword failed!");
+    QVERIFY2(m_wallet->readPassword("cached", password) == 0 && password == QLatin1String("second"), "stale password read!");
+    QVERIFY2(m_wallet->removeEntry("cached") == 0, "removeEntry failed!");
+    QVERIFY2(!m_wallet->hasEntry("cached"), "removed entry still cached!");
+}
+
+void KWalletTest::testAsync()
+{
+    QVERIFY(openTestFolder(QStringLiteral("wallettestasync")));
+
+    // the calls are answered in order
+    QStringList done;
+    m_wallet->writePasswordAsync("asyncPassword", "secret", [&done](int rc) {
+        done << (rc == 0 ? QStringLiteral("write") : QStringLiteral("write failed"));
+    });
+    m_wallet->readPasswordAsync("asyncPassword", [&done](int rc, const QString &value) {
+        done << (rc == 0 && value == QLatin1String("secret") ? QStringLiteral("read") : QStringLiteral("read failed"));
+    });
+    m_wallet->entryListAsync([&done](int rc, const QStringList &list) {
+        done << (rc == 0 && list == QStringList({QStringLiteral("asyncPassword")}) ? QStringLiteral("list") : QStringLiteral("list failed"));
+    });
+    m_wallet->removeEntryAsync("asyncPassword");
+    m_wallet->readEntryAsync("asyncPassword", [&done](int rc, const QByteArray &value) {
+        done << (rc == 0 && value.isEmpty() ? QStringLiteral("removed") : QStringLiteral("removed failed"));
+    });
+    QVERIFY2(done.isEmpty(), "callback called before returning to the event loop!");
+    QTRY_COMPARE(done, QStringList({QStringLiteral("write"), QStringLiteral("read"), QStringLiteral("list"), QStringLiteral("removed")}));
+}
+
+void KWalletTest::testWriteBehind()
+{
+    QVERIFY(openTestFolder(QStringLiteral("wallettestwritebehind")));
+
+    m_wallet->setWriteBehind(16);
+    for (int i = 0; i < 100; ++i) {
+        QVERIFY2(m_wallet->writePassword(QString::number(i), QString::number(i * i)) == 0, "writePassword failed!");
+    }
+    // reads come after the writes sent before them
+    QString password;
+    QVERIFY2(m_wallet->readPassword("99", password) == 0 && password == QLatin1String("9801"), "readPassword doesn't see the last write!");
+    QVERIFY2(m_wallet->flush() == 0, "a write failed!");
+    QVERIFY2(m_wallet->entryList().count() == 100, "not all writes arrived!");
+
+    m_wallet->setWriteBehind(0);
+}
+
+void KWalletTest::testReadEntryTyped()
+{
+    QVERIFY(openTestFolder(QStringLiteral("wallettesttyped")));
+
+    const QMap<QString, QString> map{{QStringLiteral("user"), QStringLiteral("me")}};
+    QVERIFY2(m_wallet->writeMap("typedMap", map) == 0, "writeMap failed!");
+
+    Wallet::EntryType entryType = Wallet::Unknown;
+    QByteArray value;
+    QVERIFY2(m_wallet->readEntryTyped("typedMap", entryType, value) == 0, "readEntryTyped failed!");
+    QVERIFY2(entryType == Wallet::Map, "readEntryTyped gave the wrong type!");
+    QMap<QString, QString> readMap;
+    QDataStream ds(value);
+    ds >> readMap;
+    QVERIFY2(readMap == map, "readEntryTyped gave the wrong value!");
+
+    QVERIFY2(m_wallet->readEntryTyped("missing", entryType, value) == 0, "readEntryTyped of a missing entry failed!");
+    QVERIFY2(entryType == Wallet::Unknown && value.isEmpty(), "readEntryTyped found a missing entry!");
+}
+
 QTEST_GUILESS_MAIN(KWalletTest)
@@ -9,6 +9,12 @@
 #define KWALLETTEST_H
 
 #include <QObject>
+#include <QString>
+
+namespace KWallet
+{
+class Wallet;
+}
 
 class KWalletTest : public QObject
 {
@@ -17,7 +23,21 @@ class KWalletTest : public QObject
 public:
 private Q_SLOTS:
     void init();
+    void cleanup();
     void testWallet();
+    void testManyEntries();
+    void testLargeEntry();
+    void testFolderCache();
+    void testReadCache();
+    void testAsync();
+    void testWriteBehind();
+    void testReadEntryTyped();
+
+private:
+    bool openTestFolder(const QString &folder);
+
+    KWallet::Wallet *m_wallet = nullptr;
+    QString m_folder;
 };
 
 #endif